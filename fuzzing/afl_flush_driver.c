@@ -0,0 +1,108 @@
+/*
+	Sync-flush roundtrip driver for use with afl-fuzz (fast mode)
+
+	This driver splits the input into messages, compresses them one after
+	the other with sync-flushes in between, then decompresses each message
+	on its own, checking that every message comes back out intact.
+
+	The first byte selects the variant, and each message is one longer
+	than the value of the byte it starts with.
+*/
+#include <unistd.h>
+#include <stdio.h>
+
+#define LZW_EDDY_IMPLEMENTATION
+#include "lzw.h"
+
+/* this lets the source compile without afl-clang-fast/lto */
+#ifndef __AFL_FUZZ_TESTCASE_LEN
+
+ssize_t       fuzz_len;
+unsigned char fuzz_buf[1024000];
+
+#define __AFL_FUZZ_TESTCASE_LEN fuzz_len
+#define __AFL_FUZZ_TESTCASE_BUF fuzz_buf
+#define __AFL_FUZZ_INIT() void sync(void);
+#define __AFL_LOOP(x) \
+	((fuzz_len = read(0, fuzz_buf, sizeof(fuzz_buf))) > 0 ? 1 : 0)
+#define __AFL_INIT() sync()
+#endif
+
+__AFL_FUZZ_INIT();
+
+#ifdef __clang__
+#pragma clang optimize off
+#else
+#pragma GCC optimize("O0")
+#endif
+
+int main(int argc, char *argv[]) {
+	struct lzw_state statec0;
+	struct lzw_state stated0;
+	size_t dest_size = 1UL << 21; // 2MiB
+	uint8_t *decomp = malloc(dest_size*2);
+	uint8_t *comp = decomp + dest_size;
+	size_t *msg_end = malloc((1UL << 20) * sizeof(size_t)); // At most one message per input byte.
+
+#ifdef __AFL_HAVE_MANUAL_CONTROL
+	__AFL_INIT();
+#endif
+
+	uint8_t *input = __AFL_FUZZ_TESTCASE_BUF;
+
+#ifdef __clang_major__
+	while (__AFL_LOOP(5000)) {
+#endif
+		memset(&statec0, 0, sizeof(struct lzw_state));
+		memset(&stated0, 0, sizeof(struct lzw_state));
+
+		ssize_t res;
+		size_t comp_size = 0;
+		size_t num_msgs = 0;
+
+		size_t slen = __AFL_FUZZ_TESTCASE_LEN;
+		if (input && slen > 1) {
+			statec0.variant = stated0.variant = input[0] & 3;
+
+			// Compress input from fuzzer, one message at a time.
+			for (size_t pos = 1 ; pos < slen ; ) {
+				size_t mlen = 1 + input[pos];
+				if (mlen > slen - pos)
+					mlen = slen - pos;
+				while ((res = lzw_compress_flush(&statec0, input + pos, mlen, comp + comp_size, dest_size - comp_size)) > 0) { comp_size += res; };
+				if (res < 0) {
+					abort();
+				}
+				msg_end[num_msgs++] = comp_size;
+				pos += mlen;
+			}
+			printf("compressed:%zu in %zu messages\n", comp_size, num_msgs);
+
+			// Decompress each message separately, and compare it to the original.
+			size_t comp_pos = 0;
+			size_t pos = 1;
+			for (size_t i = 0 ; i < num_msgs ; ++i) {
+				size_t mlen = 1 + input[pos];
+				if (mlen > slen - pos)
+					mlen = slen - pos;
+				size_t decomp_size = 0;
+				while ((res = lzw_decompress_flush(&stated0, comp + comp_pos, msg_end[i] - comp_pos, decomp + decomp_size, dest_size - decomp_size)) > 0) { decomp_size += res; };
+				if (res < 0) {
+					abort();
+				}
+				if (decomp_size != mlen || memcmp(input + pos, decomp, mlen) != 0) {
+					abort();
+				}
+				comp_pos = msg_end[i];
+				pos += mlen;
+			}
+			printf("decompressed:%zu\n", pos - 1);
+		}
+
+#ifdef __clang_major__
+	}
+#endif
+	free(msg_end);
+	free(decomp);
+	return EXIT_SUCCESS;
+}
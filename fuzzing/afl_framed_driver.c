@@ -0,0 +1,91 @@
+/*
+	Framed roundtrip driver for use with afl-fuzz (fast mode)
+
+	This driver compresses the input into a framed stream, then decompresses
+	it through a small output buffer, checking that stored and compressed
+	blocks both come back out intact.
+
+	The first byte selects the variant and the size of the output buffer.
+*/
+#include <unistd.h>
+#include <stdio.h>
+
+#define LZW_FRAME_BLOCK_SIZE 1024
+#define LZW_EDDY_IMPLEMENTATION
+#include "lzw.h"
+
+/* this lets the source compile without afl-clang-fast/lto */
+#ifndef __AFL_FUZZ_TESTCASE_LEN
+
+ssize_t       fuzz_len;
+unsigned char fuzz_buf[1024000];
+
+#define __AFL_FUZZ_TESTCASE_LEN fuzz_len
+#define __AFL_FUZZ_TESTCASE_BUF fuzz_buf
+#define __AFL_FUZZ_INIT() void sync(void);
+#define __AFL_LOOP(x) \
+	((fuzz_len = read(0, fuzz_buf, sizeof(fuzz_buf))) > 0 ? 1 : 0)
+#define __AFL_INIT() sync()
+#endif
+
+__AFL_FUZZ_INIT();
+
+#ifdef __clang__
+#pragma clang optimize off
+#else
+#pragma GCC optimize("O0")
+#endif
+
+int main(int argc, char *argv[]) {
+	struct lzw_state statec0;
+	struct lzw_state stated0;
+	size_t dest_size = 1UL << 21; // 2MiB
+	uint8_t *decomp = malloc(dest_size*2);
+	uint8_t *comp = decomp + dest_size;
+
+#ifdef __AFL_HAVE_MANUAL_CONTROL
+	__AFL_INIT();
+#endif
+
+	uint8_t *input = __AFL_FUZZ_TESTCASE_BUF;
+
+#ifdef __clang_major__
+	while (__AFL_LOOP(5000)) {
+#endif
+		memset(&statec0, 0, sizeof(struct lzw_state));
+		memset(&stated0, 0, sizeof(struct lzw_state));
+
+		ssize_t res;
+		size_t comp_size = 0;
+		size_t decomp_size = 0;
+
+		size_t slen = __AFL_FUZZ_TESTCASE_LEN;
+		if (input && slen > 1) {
+			statec0.variant = stated0.variant = input[0] & 3;
+			size_t dlen = 1 + (input[0] >> 2);
+
+			// Compress input from fuzzer.
+			while ((res = lzw_compress_framed(&statec0, input + 1, slen - 1, comp + comp_size, dest_size - comp_size)) > 0) { comp_size += res; };
+			printf("compressed:%zu (res=%zd)\n", comp_size, res);
+			if (res < 0) {
+				abort();
+			}
+
+			// Decompress the compressed data...
+			while ((res = lzw_decompress_framed(&stated0, comp, comp_size, decomp + decomp_size, dlen)) > 0) { decomp_size += res; };
+			printf("decompressed:%zu (res=%zd)\n", decomp_size, res);
+			if (res < 0) {
+				abort();
+			}
+
+			if (slen - 1 != decomp_size || memcmp(input + 1, decomp, decomp_size) != 0) {
+				abort();
+			}
+		}
+
+#ifdef __clang_major__
+	}
+#endif
+	free(decomp);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,115 @@
+/*
+	Scatter/gather roundtrip driver for use with afl-fuzz (fast mode)
+
+	This driver compresses the input into a set of segments of uneven sizes,
+	then decompresses it into another such set, checking that strings split
+	across segment boundaries come back out intact.
+
+	The first byte selects the variant and the segment sizes.
+*/
+#include <unistd.h>
+#include <stdio.h>
+
+#define LZW_EDDY_IMPLEMENTATION
+#include "lzw.h"
+
+/* this lets the source compile without afl-clang-fast/lto */
+#ifndef __AFL_FUZZ_TESTCASE_LEN
+
+ssize_t       fuzz_len;
+unsigned char fuzz_buf[1024000];
+
+#define __AFL_FUZZ_TESTCASE_LEN fuzz_len
+#define __AFL_FUZZ_TESTCASE_BUF fuzz_buf
+#define __AFL_FUZZ_INIT() void sync(void);
+#define __AFL_LOOP(x) \
+	((fuzz_len = read(0, fuzz_buf, sizeof(fuzz_buf))) > 0 ? 1 : 0)
+#define __AFL_INIT() sync()
+#endif
+
+__AFL_FUZZ_INIT();
+
+#ifdef __clang__
+#pragma clang optimize off
+#else
+#pragma GCC optimize("O0")
+#endif
+
+#define NUM_SEGMENTS 6
+
+// Gather `len` bytes from the segments into `out`.
+static void gather(const struct iovec *iov, size_t len, uint8_t *out) {
+	for (int i=0 ; len > 0 ; ++i) {
+		size_t n = iov[i].iov_len < len ? iov[i].iov_len : len;
+		memcpy(out, iov[i].iov_base, n);
+		out += n;
+		len -= n;
+	}
+}
+
+int main(int argc, char *argv[]) {
+	static const size_t sizes[] = { 0, 1, 2, 3, 7, 13, 64, 1500 };
+	struct lzw_state statec0;
+	struct lzw_state stated0;
+	size_t dest_size = 1UL << 21; // 2MiB
+	uint8_t *decomp = malloc(dest_size*2);
+	uint8_t *comp = decomp + dest_size;
+	uint8_t segbuf[NUM_SEGMENTS * 1500];
+	struct iovec iov[NUM_SEGMENTS];
+
+#ifdef __AFL_HAVE_MANUAL_CONTROL
+	__AFL_INIT();
+#endif
+
+	uint8_t *input = __AFL_FUZZ_TESTCASE_BUF;
+
+#ifdef __clang_major__
+	while (__AFL_LOOP(5000)) {
+#endif
+		memset(&statec0, 0, sizeof(struct lzw_state));
+		memset(&stated0, 0, sizeof(struct lzw_state));
+
+		ssize_t res;
+		size_t comp_size = 0;
+		size_t decomp_size = 0;
+
+		size_t slen = __AFL_FUZZ_TESTCASE_LEN;
+		if (input && slen > 1) {
+			statec0.variant = stated0.variant = input[0] & 3;
+			// Always leave one segment non-empty.
+			for (int i=0 ; i < NUM_SEGMENTS ; ++i) {
+				iov[i].iov_base = segbuf + i * 1500;
+				iov[i].iov_len = i == 0 ? (size_t)(1 + (input[0] >> 5)) : sizes[(input[0] + i * 3) & 7];
+			}
+
+			// Compress input from fuzzer.
+			while ((res = lzw_compressv(&statec0, input + 1, slen - 1, iov, NUM_SEGMENTS)) > 0) {
+				gather(iov, res, comp + comp_size);
+				comp_size += res;
+			}
+			printf("compressed:%zu (res=%zd)\n", comp_size, res);
+			if (res < 0) {
+				abort();
+			}
+
+			// Decompress the compressed data...
+			while ((res = lzw_decompressv(&stated0, comp, comp_size, iov, NUM_SEGMENTS)) > 0) {
+				gather(iov, res, decomp + decomp_size);
+				decomp_size += res;
+			}
+			printf("decompressed:%zu (res=%zd)\n", decomp_size, res);
+			if (res < 0) {
+				abort();
+			}
+
+			if (slen - 1 != decomp_size || memcmp(input + 1, decomp, decomp_size) != 0) {
+				abort();
+			}
+		}
+
+#ifdef __clang_major__
+	}
+#endif
+	free(decomp);
+	return EXIT_SUCCESS;
+}
@@ -7,6 +7,10 @@
 #include <string.h>
 #include <stdint.h>
 #include <errno.h>
+#include <pthread.h>
+#if !defined(_WIN32)
+#include <sys/uio.h>
+#endif
 
 #include "build_const.h"
 
@@ -14,6 +18,21 @@ static const char *infile;
 static const char *outfile;
 static int compress = 0;
 static size_t maxlen = 0;
+static enum lzw_variant variant = LZW_VARIANT_PUZZNIC;
+static uint32_t symbol_width = 0;
+static uint32_t max_code_width = 0;
+static int autotune = 0;
+static size_t autotune_budget = 0;
+static size_t autotune_sample = 0;
+static int verify = 0;
+static int framed = 0;
+static size_t flush_size = 0;
+
+static const char *variant_names[] = { "puzznic", "gif", "tiff", "z" };
+
+// Output is produced straight into page sized segments, and gathered with writev() where available.
+#define OUTPUT_SEGMENTS 8
+#define SEGMENT_SIZE 4096
 
 static void print_version(void) {
 	if (build_hash && *build_hash) {
@@ -36,7 +55,11 @@ static int parse_args(int argc, char **argv) {
 
 		if (arg && *arg == '-') {
 			++arg;
-			if (value) {
+			if (strcmp(arg, "-verify") == 0) {
+				verify = 1;
+			} else if (strcmp(arg, "-framed") == 0) {
+				framed = 1;
+			} else if (value) {
 				switch (*arg) {
 					case 'c':
 						compress = 1;
@@ -54,6 +77,39 @@ static int parse_args(int argc, char **argv) {
 					case 'm':
 						maxlen = atoi(value);
 						break;
+					case 'f': {
+						const size_t num_variants = sizeof(variant_names)/sizeof(variant_names[0]);
+						size_t v = 0;
+						while (v < num_variants && strcmp(value, variant_names[v]) != 0) {
+							++v;
+						}
+						if (v == num_variants) {
+							fprintf(stderr, "Error: Unknown variant '%s', expected one of:", value);
+							for (v=0 ; v < num_variants ; ++v) {
+								fprintf(stderr, " %s", variant_names[v]);
+							}
+							fprintf(stderr, "\n");
+							exit(EXIT_FAILURE);
+						}
+						variant = (enum lzw_variant)v;
+						break;
+					}
+					case 'b':
+						max_code_width = atoi(value);
+						break;
+					case 's':
+						symbol_width = atoi(value);
+						break;
+					case 'a':
+						autotune = 1;
+						autotune_budget = atoi(value);
+						break;
+					case 'n':
+						autotune_sample = atoi(value);
+						break;
+					case 'F':
+						flush_size = atoi(value);
+						break;
 				}
 			} else {
 				if (*arg == 'v' || *arg == 'V' || strcmp(arg, "-version") == 0) {
@@ -67,6 +123,360 @@ static int parse_args(int argc, char **argv) {
 	return 0;
 }
 
+static void init_segments(struct iovec *iov, int iovcnt, uint8_t *buf, size_t seg_size) {
+	for (int i=0 ; i < iovcnt ; ++i) {
+		iov[i].iov_base = buf + i * seg_size;
+		iov[i].iov_len = seg_size;
+	}
+}
+
+// Write the first `len` bytes of the segments, with writev() retrying after short writes.
+static int write_segments(FILE *ofile, const struct iovec *segs, int iovcnt, size_t len) {
+	struct iovec iov[OUTPUT_SEGMENTS];
+	int n = 0;
+
+	for (int i=0 ; i < iovcnt && len > 0 ; ++i) {
+		iov[n].iov_base = segs[i].iov_base;
+		iov[n].iov_len = segs[i].iov_len < len ? segs[i].iov_len : len;
+		len -= iov[n].iov_len;
+		++n;
+	}
+
+#if defined(_WIN32)
+	// No writev(), so write the segments one by one.
+	for (int i=0 ; i < n ; ++i) {
+		if (fwrite(iov[i].iov_base, iov[i].iov_len, 1, ofile) != 1) {
+			fprintf(stderr, "fwrite: %s\n", strerror(errno));
+			return -1;
+		}
+	}
+#else
+	struct iovec *p = iov;
+	while (n > 0) {
+		ssize_t res = writev(fileno(ofile), p, n);
+		if (res < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "writev: %s\n", strerror(errno));
+			return -1;
+		}
+		while (n > 0 && (size_t)res >= p->iov_len) {
+			res -= p->iov_len;
+			++p;
+			--n;
+		}
+		if (n > 0) {
+			p->iov_base = (uint8_t*)p->iov_base + res;
+			p->iov_len -= res;
+		}
+	}
+#endif
+	return 0;
+}
+
+static void init_state(struct lzw_state *state) {
+	state->variant = variant;
+	state->symbol_width = symbol_width;
+	state->max_code_width = max_code_width;
+}
+
+struct tune_job {
+	pthread_t thread;
+	struct lzw_state *state;
+	uint8_t *src;
+	size_t slen;
+	ssize_t size;
+};
+
+static void *tune_worker(void *arg) {
+	struct tune_job *job = arg;
+	uint8_t dest[4096];
+
+	ssize_t res, written = 0;
+	while ((res = lzw_compress(job->state, job->src, job->slen, dest, sizeof(dest))) > 0) {
+		written += res;
+	}
+	job->size = res < 0 ? res : written;
+
+	return NULL;
+}
+
+/*
+	Compress `src` concurrently under each candidate max code width and prefix limit, one thread per candidate,
+	and set `max_code_width` and `maxlen` to the settings giving the smallest output. With a decode buffer
+	budget, only prefix limits that fit in the budget are considered.
+*/
+static int autotune_settings(uint8_t *src, size_t slen) {
+	static const size_t limits[] = { 0, 16, 32, 64, 128, 256, 512, 1024 };
+	uint32_t min_width = variant == LZW_VARIANT_COMPRESS ? LZW_MIN_CODE_WIDTH + 1 : LZW_MIN_CODE_WIDTH;
+	// Wider codes only pay off on inputs far larger than a sample, so leave those to -b.
+	uint32_t max_width = LZW_MAX_CODE_WIDTH > 16 ? 16 : LZW_MAX_CODE_WIDTH;
+
+	// GIF and TIFF have a fixed max code width.
+	if (max_code_width > 0 || variant == LZW_VARIANT_GIF || variant == LZW_VARIANT_TIFF) {
+		min_width = max_width = max_code_width;
+	}
+
+	if (autotune_budget == 1) {
+		fprintf(stderr, "Auto-tune failed: A decode buffer budget of one byte can't be met.\n");
+		return -1;
+	}
+
+	if (autotune_sample > 0 && autotune_sample < slen) {
+		slen = autotune_sample;
+	}
+
+	// Candidate prefix limits. The decoder needs room for the longest prefix plus one symbol.
+	size_t cand_limits[sizeof(limits)/sizeof(limits[0]) + 1];
+	size_t num_limits = 0;
+	if (maxlen > 0) {
+		cand_limits[num_limits++] = maxlen;
+	} else {
+		for (size_t i=0 ; i < sizeof(limits)/sizeof(limits[0]) ; ++i) {
+			if (autotune_budget == 0 || (limits[i] > 0 && limits[i] < autotune_budget - 1)) {
+				cand_limits[num_limits++] = limits[i];
+			}
+		}
+		if (autotune_budget > 0) {
+			cand_limits[num_limits++] = autotune_budget - 1;
+		}
+	}
+
+	struct tune_job *jobs = calloc((max_width - min_width + 1) * num_limits, sizeof(*jobs));
+	if (!jobs) {
+		fprintf(stderr, "ERROR: memory allocation of tuning state failed.\n");
+		exit(1);
+	}
+
+	size_t num_jobs = 0;
+	for (uint32_t width = min_width ; width <= max_width ; ++width) {
+		for (size_t i=0 ; i < num_limits ; ++i) {
+			size_t limit = cand_limits[i];
+			struct tune_job *job = &jobs[num_jobs];
+			job->state = calloc(1, sizeof(struct lzw_state));
+			if (!job->state) {
+				fprintf(stderr, "ERROR: memory allocation of tuning state failed.\n");
+				exit(1);
+			}
+			init_state(job->state);
+			job->state->max_code_width = width;
+			job->state->longest_prefix_allowed = limit;
+			job->src = src;
+			job->slen = slen;
+			if (pthread_create(&job->thread, NULL, tune_worker, job) != 0) {
+				fprintf(stderr, "ERROR: Could not start tuning thread.\n");
+				exit(1);
+			}
+			++num_jobs;
+		}
+	}
+
+	struct tune_job *best = NULL;
+	for (size_t i=0 ; i < num_jobs ; ++i) {
+		pthread_join(jobs[i].thread, NULL);
+		if (jobs[i].size >= 0 && (!best || jobs[i].size < best->size)) {
+			best = &jobs[i];
+		}
+	}
+
+	if (best) {
+		max_code_width = best->state->max_code_width;
+		maxlen = best->state->longest_prefix_allowed;
+		printf("Auto-tune picked -b %u -m %zu out of %zu candidates (%zd bytes from %zu, longest prefix=%zu).\n",
+			max_code_width, maxlen, num_jobs, best->size, slen, best->state->longest_prefix);
+	} else if (num_jobs > 0) {
+		fprintf(stderr, "Auto-tune failed: %s (err: %zd)\n", lzw_strerror(jobs[0].size), jobs[0].size);
+	}
+	for (size_t i=0 ; i < num_jobs ; ++i) {
+		free(jobs[i].state);
+	}
+	free(jobs);
+
+	return best ? 0 : -1;
+}
+
+#define VERIFY_SLOTS 8
+
+// Chunks of compressed output handed from the compressor to the verifier thread.
+struct verify_queue {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	uint8_t buf[VERIFY_SLOTS][4096];
+	ssize_t len[VERIFY_SLOTS];
+	size_t head;
+	size_t tail;
+	int done;
+	ssize_t result;
+	struct lzw_state state;
+	uint8_t *orig;
+	size_t olen;
+};
+
+static void *verify_worker(void *arg) {
+	struct verify_queue *q = arg;
+
+	pthread_mutex_lock(&q->lock);
+	while (q->result == 0) {
+		while (q->tail == q->head && !q->done) {
+			pthread_cond_wait(&q->cond, &q->lock);
+		}
+		if (q->tail == q->head) {
+			q->result = lzw_verify(&q->state, q->buf[0], 0, q->orig, q->olen);
+			if (q->result == 0)
+				q->result = 1;
+			break;
+		}
+		size_t slot = q->tail % VERIFY_SLOTS;
+		pthread_mutex_unlock(&q->lock);
+
+		ssize_t res = lzw_verify(&q->state, q->buf[slot], q->len[slot], q->orig, q->olen);
+
+		pthread_mutex_lock(&q->lock);
+		if (res < 0) {
+			q->result = res;
+		}
+		q->tail++;
+		pthread_cond_broadcast(&q->cond);
+	}
+	pthread_mutex_unlock(&q->lock);
+
+	return NULL;
+}
+
+/*
+	Compress into a queue of chunks that a second thread decompresses and compares against `src` as they're produced.
+	Returns the final result of lzw_compress, or LZW_VERIFY_MISMATCH as soon as verification fails.
+*/
+static ssize_t compress_verified(struct lzw_state *state, uint8_t *src, size_t slen, FILE *ofile, ssize_t *written) {
+	struct verify_queue *q = calloc(1, sizeof(*q));
+	if (!q) {
+		fprintf(stderr, "ERROR: memory allocation of verification state failed.\n");
+		exit(1);
+	}
+	pthread_mutex_init(&q->lock, NULL);
+	pthread_cond_init(&q->cond, NULL);
+	init_state(&q->state);
+	q->orig = src;
+	q->olen = slen;
+
+	pthread_t thread;
+	if (pthread_create(&thread, NULL, verify_worker, q) != 0) {
+		fprintf(stderr, "ERROR: Could not start verification thread.\n");
+		exit(1);
+	}
+
+	ssize_t res;
+	for (;;) {
+		pthread_mutex_lock(&q->lock);
+		while (q->head - q->tail == VERIFY_SLOTS && q->result == 0) {
+			pthread_cond_wait(&q->cond, &q->lock);
+		}
+		ssize_t failed = q->result;
+		pthread_mutex_unlock(&q->lock);
+		if (failed < 0) {
+			res = failed;
+			break;
+		}
+
+		size_t slot = q->head % VERIFY_SLOTS;
+		res = lzw_compress(state, src, slen, q->buf[slot], sizeof(q->buf[slot]));
+		if (res <= 0)
+			break;
+		fwrite(q->buf[slot], res, 1, ofile);
+		*written += res;
+
+		pthread_mutex_lock(&q->lock);
+		q->len[slot] = res;
+		q->head++;
+		pthread_cond_broadcast(&q->cond);
+		pthread_mutex_unlock(&q->lock);
+	}
+
+	pthread_mutex_lock(&q->lock);
+	q->done = 1;
+	pthread_cond_broadcast(&q->cond);
+	pthread_mutex_unlock(&q->lock);
+	pthread_join(thread, NULL);
+
+	if (res == 0 && q->result < 0) {
+		res = q->result;
+	} else if (res == 0) {
+		printf("Verified %zu bytes.\n", q->state.wptr);
+	}
+
+	pthread_cond_destroy(&q->cond);
+	pthread_mutex_destroy(&q->lock);
+	free(q);
+
+	return res;
+}
+
+/*
+	Compress `src` as a stream of sync-flushed messages of `flush_size` bytes each, sharing one string table.
+	Each message is written with its compressed length in front, as 32-bit little-endian, so it can be decoded on its own.
+*/
+static ssize_t compress_messages(struct lzw_state *state, uint8_t *src, size_t slen, FILE *ofile, ssize_t *written) {
+	uint8_t dest[SEGMENT_SIZE];
+	uint8_t *msg = NULL;
+	size_t msg_size = 0;
+	ssize_t res = 0;
+
+	for (size_t pos = 0 ; pos < slen && res >= 0 ; pos += flush_size) {
+		size_t mlen = slen - pos < flush_size ? slen - pos : flush_size;
+		size_t clen = 0;
+
+		while ((res = lzw_compress_flush(state, src + pos, mlen, dest, sizeof(dest))) > 0) {
+			if (clen + res > msg_size) {
+				msg_size = 2 * (clen + res);
+				msg = realloc(msg, msg_size);
+				if (!msg) {
+					fprintf(stderr, "ERROR: memory allocation of %zu bytes failed.\n", msg_size);
+					exit(1);
+				}
+			}
+			memcpy(msg + clen, dest, res);
+			clen += res;
+		}
+		if (res == 0) {
+			uint8_t header[4] = { clen & 0xFF, (clen >> 8) & 0xFF, (clen >> 16) & 0xFF, (clen >> 24) & 0xFF };
+			if (fwrite(header, sizeof(header), 1, ofile) != 1 || (clen > 0 && fwrite(msg, clen, 1, ofile) != 1)) {
+				fprintf(stderr, "fwrite: %s\n", strerror(errno));
+				exit(EXIT_FAILURE);
+			}
+			*written += sizeof(header) + clen;
+		}
+	}
+	free(msg);
+
+	return res;
+}
+
+// Decompress a stream written by compress_messages(), one message at a time.
+static ssize_t decompress_messages(struct lzw_state *state, uint8_t *src, size_t slen, FILE *ofile, ssize_t *written) {
+	uint8_t dest[SEGMENT_SIZE];
+	ssize_t res = 0;
+
+	for (size_t pos = 0 ; pos < slen && res >= 0 ; ) {
+		if (slen - pos < 4)
+			return LZW_INVALID_CODE_STREAM;
+		size_t clen = src[pos] | (src[pos + 1] << 8) | (src[pos + 2] << 16) | ((size_t)src[pos + 3] << 24);
+		pos += 4;
+		if (clen > slen - pos)
+			return LZW_INVALID_CODE_STREAM;
+
+		while ((res = lzw_decompress_flush(state, src + pos, clen, dest, sizeof(dest))) > 0) {
+			if (fwrite(dest, res, 1, ofile) != 1) {
+				fprintf(stderr, "fwrite: %s\n", strerror(errno));
+				exit(EXIT_FAILURE);
+			}
+			*written += res;
+		}
+		pos += clen;
+	}
+
+	return res;
+}
+
 static void lzw_compress_file(const char *srcfile, const char *destfile) {
 	FILE *ifile = fopen(srcfile, "rb");
 
@@ -86,33 +496,74 @@ static void lzw_compress_file(const char *srcfile, const char *destfile) {
 			fprintf(stderr, "ERROR: memory allocation of %ld bytes failed.\n", slen);
 			exit(1);
 		}
-		uint8_t dest[4096];
-
-		struct lzw_state state = { 0 };
-		if (maxlen > 0) {
-			state.longest_prefix_allowed = maxlen;
-			printf("WARNING: Restricting maximum prefix length to %zu.\n", state.longest_prefix_allowed);
-		}
+		uint8_t dest[OUTPUT_SEGMENTS * SEGMENT_SIZE];
+		struct iovec iov[OUTPUT_SEGMENTS];
+		init_segments(iov, OUTPUT_SEGMENTS, dest, SEGMENT_SIZE);
 
 		if ((fread(src, slen, 1, ifile) != 1) && (ferror(ifile) != 0)) {
 			fprintf(stderr, "fread '%s': %s", srcfile, strerror(errno));
 			exit(EXIT_FAILURE);
 		}
 
+		if (autotune && autotune_settings(src, slen) != 0) {
+			exit(EXIT_FAILURE);
+		}
+
+		// The state is too large for the stack with wide codes.
+		struct lzw_state *state = calloc(1, sizeof(struct lzw_state));
+		if (!state) {
+			fprintf(stderr, "ERROR: memory allocation of %zu bytes failed.\n", sizeof(struct lzw_state));
+			exit(1);
+		}
+		init_state(state);
+		if (maxlen > 0) {
+			state->longest_prefix_allowed = maxlen;
+			printf("WARNING: Restricting maximum prefix length to %zu.\n", state->longest_prefix_allowed);
+		}
+
 		ssize_t res, written = 0;
-		while ((res = lzw_compress(&state, src, slen, dest, sizeof(dest))) > 0) {
-			fwrite(dest, res, 1, ofile);
-			written += res;
+		if (verify) {
+			res = compress_verified(state, src, slen, ofile, &written);
+		} else if (flush_size > 0) {
+			res = compress_messages(state, src, slen, ofile, &written);
+		} else if (framed) {
+			// Each call produces one block, which must fit whole.
+			uint8_t *block = malloc(LZW_FRAME_HEADER_SIZE + LZW_FRAME_BLOCK_SIZE);
+			if (!block) {
+				fprintf(stderr, "ERROR: memory allocation of %d bytes failed.\n", LZW_FRAME_HEADER_SIZE + LZW_FRAME_BLOCK_SIZE);
+				exit(1);
+			}
+			while ((res = lzw_compress_framed(state, src, slen, block, LZW_FRAME_HEADER_SIZE + LZW_FRAME_BLOCK_SIZE)) > 0) {
+				if (fwrite(block, res, 1, ofile) != 1) {
+					fprintf(stderr, "fwrite: %s\n", strerror(errno));
+					exit(EXIT_FAILURE);
+				}
+				written += res;
+			}
+			free(block);
+		} else {
+			while ((res = lzw_compressv(state, src, slen, iov, OUTPUT_SEGMENTS)) > 0) {
+				if (write_segments(ofile, iov, OUTPUT_SEGMENTS, res) != 0)
+					exit(EXIT_FAILURE);
+				written += res;
+			}
 		}
 		if (res == 0) {
 			printf("%zd bytes written to output, reduction=%2.02f%% (longest prefix=%zu).\n",
 					written,
 					(1.0f - ((float)written/slen)) * 100.0f,
-					state.longest_prefix);
+					state->longest_prefix);
 		} else if (res < 0) {
 			fprintf(stderr, "Compression returned error: %s (err: %zd)\n", lzw_strerror(res), res);
+			// Output that failed verification mustn't be mistaken for good output.
+			if (verify) {
+				fclose(ofile);
+				remove(destfile);
+				exit(EXIT_FAILURE);
+			}
 		}
 		fclose(ofile);
+		free(state);
 		free(src);
 	} else {
 		fprintf(stderr, "Error: %m\n");
@@ -138,12 +589,16 @@ static void lzw_decompress_file(const char *srcfile, const char *destfile) {
 			ofile = fopen(destfile, "wb");
 		}
 		if (ofile) {
-			uint8_t dest[4096];
-			size_t dest_len = sizeof(dest);
+			uint8_t dest[OUTPUT_SEGMENTS * SEGMENT_SIZE];
+			struct iovec iov[OUTPUT_SEGMENTS];
+			int iovcnt = OUTPUT_SEGMENTS;
+			size_t dest_len = SEGMENT_SIZE;
 			if (maxlen > 0 && maxlen + 1 < dest_len) {
 				dest_len = maxlen + 1;
+				iovcnt = 1;
 				printf("WARNING: Restricting output buffer to %zu bytes.\n", dest_len);
 			}
+			init_segments(iov, iovcnt, dest, dest_len);
 			uint8_t *src = malloc(slen);
 			if (!src) {
 				fprintf(stderr, "ERROR: memory allocation of %ld bytes failed.\n", slen);
@@ -155,23 +610,40 @@ static void lzw_decompress_file(const char *srcfile, const char *destfile) {
 				exit(EXIT_FAILURE);
 			}
 
-			struct lzw_state state = { 0 };
+			struct lzw_state *state = calloc(1, sizeof(struct lzw_state));
+			if (!state) {
+				fprintf(stderr, "ERROR: memory allocation of %zu bytes failed.\n", sizeof(struct lzw_state));
+				exit(1);
+			}
+			init_state(state);
 
 			ssize_t res, written = 0;
-			// Returns 0 when done, otherwise number of bytes written to destination buffer. On error, < 0.
-			while ((res = lzw_decompress(&state, src, slen, dest, dest_len)) > 0) {
-				fwrite(dest, res, 1, ofile);
-				written += res;
+			fflush(ofile);
+			if (flush_size > 0) {
+				res = decompress_messages(state, src, slen, ofile, &written);
+			} else {
+				// Returns 0 when done, otherwise number of bytes written to destination buffer. On error, < 0.
+				while ((res = framed ? lzw_decompress_framed(state, src, slen, dest, dest_len) : lzw_decompressv(state, src, slen, iov, iovcnt)) > 0) {
+					// Strings are split across calls, so check the restriction like a decoder that needs whole strings would.
+					if (!framed && maxlen > 0 && state->longest_prefix + 1 > dest_len) {
+						res = LZW_DESTINATION_TOO_SMALL;
+						break;
+					}
+					if (write_segments(ofile, iov, framed ? 1 : iovcnt, res) != 0)
+						exit(EXIT_FAILURE);
+					written += res;
+				}
 			}
 			if (res == 0) {
 				printf("%zd bytes written to output, expansion=%2.2f%% (longest prefix=%zu).\n",
 					written,
 					((float)written/slen - 1.0f) * 100.0f,
-					state.longest_prefix);
+					state->longest_prefix);
 			} else if (res < 0) {
 				fprintf(stderr, "Decompression returned error: %s (err: %zd)\n", lzw_strerror(res), res);
 			}
 			fclose(ofile);
+			free(state);
 			free(src);
 		} else {
 			fprintf(stderr, "Error: %m\n");
@@ -186,7 +658,7 @@ int main(int argc, char *argv []) {
 	print_banner();
 
 	if (!infile || !outfile) {
-		printf("Usage: %s -c file|-d file -o outfile\n", argv[0]);
+		printf("Usage: %s -c file|-d file -o outfile [-f puzznic|gif|tiff|z] [-b max-code-width] [-s symbol-width] [-m max-prefix-len] [-a decode-budget [-n sample-size]] [--verify] [--framed] [-F message-size]\n", argv[0]);
 		printf("Compiled Configuration:\n LZW_MIN_CODE_WIDTH=%d, LZW_MAX_CODE_WIDTH=%d, LZW_MAX_CODES=%lu, sizeof(lzw_state)=%zu\n",
 			LZW_MIN_CODE_WIDTH,
 			LZW_MAX_CODE_WIDTH,
@@ -196,6 +668,11 @@ int main(int argc, char *argv []) {
 		return EXIT_SUCCESS;
 	}
 
+	if (verify + framed + (flush_size > 0) > 1) {
+		fprintf(stderr, "Error: Only one of --verify, --framed and -F can be used at a time.\n");
+		return EXIT_FAILURE;
+	}
+
 	if (compress) {
 		lzw_compress_file(infile, outfile);
 	} else {
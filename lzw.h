@@ -20,24 +20,69 @@ typedef SSIZE_T ssize_t;
 #include <sys/types.h> // for ssize_t
 #endif
 
+// For lzw_decompressv/lzw_compressv. Windows doesn't have one, so we provide it, with the POSIX layout.
+// Elsewhere it comes from <sys/uio.h>, which callers of those functions need to include themselves.
+#if defined(_WIN32)
+struct iovec {
+	void *iov_base;
+	size_t iov_len;
+};
+#else
+struct iovec;
+#endif
+
 #define LZW_EDDY_MAJOR_VERSION 1
 #define LZW_EDDY_MINOR_VERSION 1
 #define LZW_EDDY_PATCH_VERSION 1
 #define LZW_EDDY_VERSION "1.1.1-dev"
 
 #define LZW_MIN_CODE_WIDTH 9
-// 9 to 16-bit codes should all work, but 12 is the default for a reason.
-// Going beyond 16-bit codes would require code changes. More isn't better either.
+// 9 to 24-bit codes should all work, but 12 is the default for a reason. More isn't better either,
+// except for large and highly repetitive inputs.
 #ifndef LZW_MAX_CODE_WIDTH
 #define LZW_MAX_CODE_WIDTH 12
 #endif
 #define LZW_MAX_CODES (1UL << LZW_MAX_CODE_WIDTH)
 
+// The encoder looks up strings in a hash table instead of scanning the string table, at the cost of
+// memory for another table. Always used beyond 16-bit codes, where a linear scan is impractical.
+#if LZW_MAX_CODE_WIDTH > 16 && !defined(LZW_HASHED_LOOKUP)
+#define LZW_HASHED_LOOKUP
+#endif
+
+// Define LZW_PACKED_STRINGS to have the decoder keep strings of up to eight bytes packed into a word, so that
+// they can be written with a single store instead of walking the string table. Costs memory for another table.
+
+// Framed streams are cut into blocks of up to this many input bytes, each either compressed on its own or stored.
+// Every block starts with a header of one type byte and the little-endian 32-bit length of what follows.
+#ifndef LZW_FRAME_BLOCK_SIZE
+#define LZW_FRAME_BLOCK_SIZE (64*1024)
+#endif
+#define LZW_FRAME_HEADER_SIZE 5
+
 enum lzw_errors {
 	LZW_NOERROR = 0,
 	LZW_DESTINATION_TOO_SMALL = -1,
 	LZW_INVALID_CODE_STREAM = -2,
 	LZW_STRING_TABLE_FULL = -3,
+	LZW_INVALID_PARAMETER = -4,
+	LZW_INVALID_SYMBOL = -5,
+	LZW_VERIFY_MISMATCH = -6,
+};
+
+/*
+	Bitstream conventions. Each one is a separately specialized instance of the same codec.
+
+	LZW_VARIANT_PUZZNIC: LSB-first, CLEAR and EOF codes. The default, bit-compatible with Puzznic.
+	LZW_VARIANT_GIF: As above, but with `symbol_width` (the GIF 'minimum code size') root codes, 12-bit max.
+	LZW_VARIANT_TIFF: MSB-first, code width grows one code early ("early change"), 12-bit max.
+	LZW_VARIANT_COMPRESS: compress(1) .Z block mode; three byte header, no EOF code, codes in groups of eight.
+*/
+enum lzw_variant {
+	LZW_VARIANT_PUZZNIC = 0,
+	LZW_VARIANT_GIF,
+	LZW_VARIANT_TIFF,
+	LZW_VARIANT_COMPRESS,
 };
 
 // This type must be large enough for SYMBOL_BITS + LZW_MAX_CODE_WIDTH*2 bits.
@@ -46,8 +91,13 @@ typedef uint64_t lzw_node;
 #else
 typedef uint32_t lzw_node;
 #endif
+#if LZW_MAX_CODE_WIDTH > 16
+typedef uint64_t bitres_t;
+typedef uint32_t code_t;
+#else
 typedef uint32_t bitres_t;
 typedef uint16_t code_t;
+#endif
 typedef uint8_t sym_t;
 
 struct lzw_string_table {
@@ -55,20 +105,45 @@ struct lzw_string_table {
 	code_t next_code;
 	code_t prev_code;
 	lzw_node node[LZW_MAX_CODES]; // 16K at 12-bit codes.
+#ifdef LZW_HASHED_LOOKUP
+	// Encoder only. Maps parent and symbol to the newest code, zero marks an empty slot.
+	code_t hash[LZW_MAX_CODES * 2];
+#endif
+#ifdef LZW_PACKED_STRINGS
+	// Decoder only. The string for each code of up to eight symbols, in memory order.
+	uint64_t packed[LZW_MAX_CODES];
+#endif
 };
 
 struct lzw_state {
 	struct lzw_string_table tree;
 
-	// If we ever need more of these, change to a flag-word.
-	bool	 was_init;
-	bool	 must_reset;
+	// Bitstream convention, and its parameters. Set these before the first call, zero selects the default.
+	enum lzw_variant variant;
+	uint32_t symbol_width; // Bits per symbol, 2-8 for GIF, otherwise 8.
+	uint32_t max_code_width; // Up to LZW_MAX_CODE_WIDTH. Must match between encoder and decoder.
+
+	uint32_t flags;
 
 	size_t rptr;
 	size_t wptr;
 	// Bit reservoir, need room for LZW_MAX_CODE_WIDTH*2-1 bits.
 	bitres_t bitres;
 	uint32_t bitres_len;
+	// compress(1) only: codes in the current group, and padding bits left to skip.
+	uint32_t group_codes;
+	uint32_t pad_bits;
+	// Decoder only: the code whose string was cut short at the end of `dest`, and how many bytes of it are left.
+	code_t split_code;
+	size_t split_left;
+	// lzw_compressv only: output staged to be split across segments. lzw_verify collects a split .Z header here.
+	uint8_t stage[64];
+	uint32_t stage_len;
+	uint32_t stage_pos;
+	// lzw_compress_framed/lzw_decompress_framed only: the current block, its type, and bytes of it left.
+	size_t frame_rptr;
+	uint32_t frame_type;
+	size_t frame_left;
 
 	// Tracks the longest prefix used, which is equal to the minimum output buffer required for decompression.
 	size_t longest_prefix;
@@ -88,16 +163,11 @@ const char *lzw_strerror(enum lzw_errors errnum);
 
 	Neither `src` nor `dest` may be NULL.
 
-	`state`should be zero-initialized.
-
-	`dlen` should be at least 4096 bytes, unless the input is known to
-	require less.
+	`state`should be zero-initialized, except for the variant parameters.
 
-	`LZWD_DESTINATION_TOO_SMALL` will be returned if the output buffer is too small, in which case
-	you'd have to restart from the beginning with a larger `dest`.
-
-	All that said, even a file consisting of 80K zeros requires only 400 bytes,
-	so we're being very conservative here. A 'normal' file may need only 128 bytes or so.
+	`dest` is filled completely before returning, except at the end of the input. A string that
+	doesn't fit is cut short, and the rest of it is written at the start of the next call,
+	so any non-zero `dlen` works.
 */
 ssize_t lzw_decompress(struct lzw_state *state, uint8_t *src, size_t slen, uint8_t *dest, size_t dlen);
 
@@ -110,10 +180,88 @@ ssize_t lzw_decompress(struct lzw_state *state, uint8_t *src, size_t slen, uint8
 
 	Neither `src` nor `dest` may be NULL.
 
-	`state`should be zero-initialized.
+	`state`should be zero-initialized, except for the variant parameters.
+
+	The encoder keeps room for its worst case at the end of `dest`, which is at most 32 bytes. If `dlen`
+	is too small to make any progress, `LZW_DESTINATION_TOO_SMALL` is returned.
 */
 ssize_t lzw_compress(struct lzw_state *state, uint8_t *src, size_t slen, uint8_t *dest, size_t dlen);
 
+/*
+	Verify compressed output against the original `orig` of length `olen`, while it's being produced.
+
+	Pass each chunk returned by `lzw_compress` as `src`, in order, using a separate `state` set up with
+	the same variant parameters as the compressor. Chunks may be split anywhere, even inside a code or
+	the .Z header. The output is compared against `orig` in place, so no output buffer is needed, and
+	`state->wptr` tracks how much of `orig` has been verified so far.
+
+	Returns the number of bytes verified from this chunk, or `LZW_VERIFY_MISMATCH` as soon as the output
+	diverges or the stream turns out to be invalid. Only bad variant parameters are reported as such.
+	Call with `slen` zero after the last chunk; this returns 0 if all of `orig` was reproduced.
+
+	This may be run on a different thread than the compressor, as long as the chunks are handed over in order.
+*/
+ssize_t lzw_verify(struct lzw_state *state, uint8_t *src, size_t slen, uint8_t *orig, size_t olen);
+
+/*
+	Compress a stream of messages that share one string table, ending each at a sync-flush point.
+
+	Call repeatedly with the same message as `src`, like `lzw_compress`, until it returns 0. All codes
+	for the message have then been written, padded to a byte boundary, and the next call starts on the
+	next message. No EOF code is written; the table carries over, so later messages compress better.
+
+	Requires a smallest code width of at least eight bits, i.e a `symbol_width` of seven or more,
+	otherwise the padding could be mistaken for a code. Don't mix with calls to `lzw_compress`.
+*/
+ssize_t lzw_compress_flush(struct lzw_state *state, uint8_t *src, size_t slen, uint8_t *dest, size_t dlen);
+
+/*
+	Decompress one message produced by `lzw_compress_flush`, given in full as `src`.
+
+	Call repeatedly until it returns 0, then call with the next message. The decoder drops the padding
+	at the end of each message and continues with the same string table.
+*/
+ssize_t lzw_decompress_flush(struct lzw_state *state, uint8_t *src, size_t slen, uint8_t *dest, size_t dlen);
+
+/*
+	Decompress into the `iovcnt` segments of `iov`, filling each completely before moving on to the next.
+
+	Strings are split at segment boundaries, so the output is contiguous across segments, and the
+	segments can be handed straight to writev(). Empty segments are skipped, but if all of them are,
+	LZW_DESTINATION_TOO_SMALL is returned.
+
+	Returns the total number of bytes written across all segments, like `lzw_decompress` otherwise.
+*/
+ssize_t lzw_decompressv(struct lzw_state *state, uint8_t *src, size_t slen, const struct iovec *iov, int iovcnt);
+
+/*
+	Compress into the `iovcnt` segments of `iov`, filling each completely before moving on to the next.
+
+	Returns the total number of bytes written across all segments, like `lzw_compress` otherwise, and
+	LZW_DESTINATION_TOO_SMALL if they're all empty. Don't mix with calls to `lzw_compress` on the same `state`.
+*/
+ssize_t lzw_compressv(struct lzw_state *state, uint8_t *src, size_t slen, const struct iovec *iov, int iovcnt);
+
+/*
+	Compress `slen` bytes from `src` into a framed stream, one block of up to LZW_FRAME_BLOCK_SIZE bytes per call.
+
+	Each block gets a fresh string table. Blocks that don't shrink, such as random or already compressed
+	data, are stored as-is, so the output never grows by more than the block headers. Byte statistics
+	are used to spot such blocks early, so that little time is spent trying to compress them.
+
+	`dlen` must be at least LZW_FRAME_HEADER_SIZE + LZW_FRAME_BLOCK_SIZE, or the size of the remaining input
+	plus the header if less. Returns the number of bytes written, and 0 once all input has been consumed.
+*/
+ssize_t lzw_compress_framed(struct lzw_state *state, uint8_t *src, size_t slen, uint8_t *dest, size_t dlen);
+
+/*
+	Decompress a framed stream produced by `lzw_compress_framed`, given in full as `src`.
+
+	Stored blocks are copied straight through. Strings are split across calls, so any non-zero `dlen` works.
+	Returns the number of bytes written to `dest`, and 0 once all input has been consumed.
+*/
+ssize_t lzw_decompress_framed(struct lzw_state *state, uint8_t *src, size_t slen, uint8_t *dest, size_t dlen);
+
 #ifdef LZW_EDDY_IMPLEMENTATION
 
 /*
@@ -127,6 +275,24 @@ ssize_t lzw_compress(struct lzw_state *state, uint8_t *src, size_t slen, uint8_t
 #include <stdint.h>
 #include <assert.h>
 #include <stdbool.h>
+#if !defined(_WIN32)
+#include <sys/uio.h>
+#endif
+
+// The encoder's string table scan has SSE4.2 and AVX2 versions, picked at runtime from what the CPU supports, so
+// that builds don't need -march=native to use them. Define LZW_NO_DISPATCH to use the portable version only.
+#if !defined(LZW_NO_DISPATCH) && !defined(LZW_HASHED_LOOKUP)
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define LZW_DISPATCH_X86
+#include <immintrin.h>
+#endif
+#endif
+
+#if defined(_MSC_VER)
+#define LZW_FORCE_INLINE static __forceinline
+#else
+#define LZW_FORCE_INLINE static inline __attribute__((always_inline))
+#endif
 
 #define SYMBOL_BITS 8
 #define SYMBOL_MASK ((1UL << SYMBOL_BITS)-1)
@@ -141,10 +307,39 @@ ssize_t lzw_compress(struct lzw_state *state, uint8_t *src, size_t slen, uint8_t
 #define CODE_EOF (CODE_CLEAR+1)
 #define CODE_FIRST (CODE_CLEAR+2)
 
+// Bits in lzw_state.flags
+#define STATE_WAS_INIT (1UL << 0)
+#define STATE_MUST_RESET (1UL << 1)
+#define STATE_END (1UL << 2)
+#define STATE_SYNCED (1UL << 3) // Message complete, the next call starts on a new one.
+
+// Variant features. These are only ever passed as constants, so each variant compiles to its own code.
+#define VARIANT_MSB_FIRST (1UL << 0) // Codes are packed most significant bit first.
+#define VARIANT_EARLY_CHANGE (1UL << 1) // Code width grows one code early.
+#define VARIANT_ROOT_WIDTH (1UL << 2) // Number of root codes is given by `symbol_width`.
+#define VARIANT_BLOCK_MODE (1UL << 3) // compress(1): header, no EOF code, width changes pad to a group of eight codes.
+#define VARIANT_DEFERRED_CLEAR (1UL << 4) // Decoder keeps going without adding codes once the table is full.
+#define VARIANT_VERIFY (1UL << 5) // Decoder compares against `dest` instead of writing to it, and takes input in chunks.
+#define VARIANT_FLUSH (1UL << 6) // Input is a sequence of messages, each ending at a byte aligned sync-flush point.
+
+#define VARIANT_PUZZNIC_FLAGS 0
+#define VARIANT_GIF_FLAGS (VARIANT_ROOT_WIDTH | VARIANT_DEFERRED_CLEAR)
+#define VARIANT_TIFF_FLAGS (VARIANT_MSB_FIRST | VARIANT_EARLY_CHANGE | VARIANT_DEFERRED_CLEAR)
+#define VARIANT_COMPRESS_FLAGS (VARIANT_BLOCK_MODE | VARIANT_DEFERRED_CLEAR)
+
+// Block types of framed streams. Zero is never used, so that it can mark being between blocks.
+#define FRAME_STORED 1
+#define FRAME_LZW 2
+// Bytes of a random looking block to test compress, before giving up on it.
+#define FRAME_SAMPLE_SIZE 4096
+
 static_assert((LZW_MAX_CODE_WIDTH >= LZW_MIN_CODE_WIDTH), "");
 static_assert(SYMBOL_BITS <= sizeof(sym_t)*8, "sym_t type too small");
 static_assert((SYMBOL_BITS + PARENT_BITS + PREFIXLEN_BITS) <= sizeof(lzw_node)*8, "lzw_node type too small");
 static_assert((LZW_MAX_CODE_WIDTH*2 - 1) < sizeof(bitres_t)*8, "bitres_t type too small");
+static_assert((LZW_MAX_CODE_WIDTH + SYMBOL_BITS) <= 32, "LZW_MAX_CODE_WIDTH too large for hash key");
+static_assert(LZW_FRAME_BLOCK_SIZE > 0 && LZW_FRAME_BLOCK_SIZE <= (1UL << 24), "LZW_FRAME_BLOCK_SIZE out of range");
+static_assert((LZW_MAX_CODE_WIDTH/8 + 1 + 2 + 2 + LZW_MAX_CODE_WIDTH) < sizeof(((struct lzw_state *)0)->stage), "stage too small for encoder reserve");
 
 static inline sym_t lzw_node_symbol(lzw_node node) {
 	return node & SYMBOL_MASK;
@@ -159,7 +354,7 @@ static inline code_t lzw_node_prefix_len(lzw_node node) {
 }
 
 static inline lzw_node lzw_make_node(sym_t symbol, code_t parent, code_t len) {
-	lzw_node node = (len << PREFIXLEN_SHIFT) | (parent << PARENT_SHIFT) | symbol;
+	lzw_node node = ((lzw_node)len << PREFIXLEN_SHIFT) | ((lzw_node)parent << PARENT_SHIFT) | symbol;
 	return node;
 }
 
@@ -167,22 +362,86 @@ static inline uint32_t mask_from_width(uint32_t width) {
 	return (1UL << width)-1;
 }
 
-static void lzw_reset(struct lzw_state *state) {
-	state->tree.prev_code = CODE_EOF;
-	state->tree.next_code = CODE_FIRST;
-	state->tree.code_width = LZW_MIN_CODE_WIDTH;
-	state->must_reset = false;
+#ifdef LZW_PACKED_STRINGS
+#define PACKED_MAX_LEN 8
+
+// Shift to put the symbol at index `i` of a packed string, such that storing the word writes the string in order.
+static inline uint32_t lzw_packed_shift(size_t i) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	return (uint32_t)(56 - i * 8);
+#else
+	return (uint32_t)(i * 8);
+#endif
 }
+#endif
+
+// The CLEAR code doubles as the 'no previous code' marker, since it's never a prefix.
+LZW_FORCE_INLINE code_t lzw_code_clear(const struct lzw_state *state, const uint32_t variant) {
+	return (variant & VARIANT_ROOT_WIDTH) ? (code_t)(1UL << state->symbol_width) : CODE_CLEAR;
+}
+
+LZW_FORCE_INLINE code_t lzw_code_first(const struct lzw_state *state, const uint32_t variant) {
+	return lzw_code_clear(state, variant) + ((variant & VARIANT_BLOCK_MODE) ? 1 : 2);
+}
+
+LZW_FORCE_INLINE void lzw_reset(struct lzw_state *state, const uint32_t variant) {
+	state->tree.prev_code = lzw_code_clear(state, variant);
+	state->tree.next_code = lzw_code_first(state, variant);
+	state->tree.code_width = (variant & VARIANT_ROOT_WIDTH) ? state->symbol_width + 1 : LZW_MIN_CODE_WIDTH;
+	state->flags &= ~STATE_MUST_RESET;
+}
+
+static uint32_t lzw_default_max_code_width(enum lzw_variant variant) {
+	switch (variant) {
+		case LZW_VARIANT_GIF:
+			/* fallthrough */
+		case LZW_VARIANT_TIFF:
+			return 12;
+		case LZW_VARIANT_COMPRESS:
+			return LZW_MAX_CODE_WIDTH < 16 ? LZW_MAX_CODE_WIDTH : 16;
+		case LZW_VARIANT_PUZZNIC:
+			break;
+	}
+	return LZW_MAX_CODE_WIDTH;
+}
+
+LZW_FORCE_INLINE enum lzw_errors lzw_init(struct lzw_state *state, const uint32_t variant) {
+	if (state->symbol_width == 0)
+		state->symbol_width = SYMBOL_BITS;
+	if (state->max_code_width == 0)
+		state->max_code_width = lzw_default_max_code_width(state->variant);
+
+	if ((variant & VARIANT_ROOT_WIDTH) ? (state->symbol_width < 2 || state->symbol_width > SYMBOL_BITS) : (state->symbol_width != SYMBOL_BITS))
+		return LZW_INVALID_PARAMETER;
+	if (state->max_code_width <= state->symbol_width || state->max_code_width > LZW_MAX_CODE_WIDTH)
+		return LZW_INVALID_PARAMETER;
+	// compress(1) -b9 switches to 10-bit codes once the table is full. We don't replicate that.
+	// Nor does anything read .Z files with codes wider than 16 bits.
+	if ((variant & VARIANT_BLOCK_MODE) && (state->max_code_width <= LZW_MIN_CODE_WIDTH || state->max_code_width > 16))
+		return LZW_INVALID_PARAMETER;
 
-static void lzw_init(struct lzw_state *state) {
 	for (size_t i=0 ; i < (1UL << SYMBOL_BITS) ; ++i) {
 		state->tree.node[i] = lzw_make_node((sym_t)i, 0, 0);
+#ifdef LZW_PACKED_STRINGS
+		state->tree.packed[i] = (uint64_t)i << lzw_packed_shift(0);
+#endif
 	}
 	state->rptr = 0;
 	state->bitres = 0;
 	state->bitres_len = 0;
-	state->was_init = true;
-	lzw_reset(state);
+	state->group_codes = 0;
+	state->pad_bits = 0;
+	state->flags = STATE_WAS_INIT;
+	lzw_reset(state, variant);
+
+	return LZW_NOERROR;
+}
+
+// compress(1) moves codes in groups of eight, and discards the rest of the group when the code width changes.
+static inline uint32_t lzw_group_padding(struct lzw_state *state) {
+	uint32_t pad = ((8 - (state->group_codes & 7)) & 7) * state->tree.code_width;
+	state->group_codes = 0;
+	return pad;
 }
 
 const char *lzw_strerror(enum lzw_errors errnum) {
@@ -201,26 +460,115 @@ const char *lzw_strerror(enum lzw_errors errnum) {
 		case LZW_STRING_TABLE_FULL:
 			errstr = "String table full";
 			break;
-
+		case LZW_INVALID_PARAMETER:
+			errstr = "Invalid or unsupported variant parameter";
+			break;
+		case LZW_INVALID_SYMBOL:
+			errstr = "Input symbol out of range";
+			break;
+		case LZW_VERIFY_MISMATCH:
+			errstr = "Decompressed data does not match original";
+			break;
 	}
 	return errstr;
 }
 
-ssize_t lzw_decompress(struct lzw_state *state, uint8_t *src, size_t slen, uint8_t *dest, size_t dlen) {
-	if (state->was_init == false)
-		lzw_init(state);
+LZW_FORCE_INLINE enum lzw_errors lzw_init_decoder(struct lzw_state *state, const uint32_t variant, uint8_t *src, size_t slen) {
+	size_t header_len = 0;
+
+	if (variant & VARIANT_BLOCK_MODE) {
+		// Magic, then the max code width and block mode flag.
+		if (slen < 3 || src[0] != 0x1F || src[1] != 0x9D || (src[2] & 0x80) == 0) {
+			return LZW_INVALID_CODE_STREAM;
+		}
+		state->max_code_width = src[2] & 0x1F;
+		header_len = 3;
+	}
+
+	enum lzw_errors err = lzw_init(state, variant);
+	state->rptr = header_len;
+
+	return err;
+}
+
+// Write the start of the last `left` bytes of the string for `code`, as much as fits in `dlen`.
+static size_t lzw_output_string_tail(struct lzw_state *state, code_t code, size_t left, uint8_t *dest, size_t dlen) {
+	size_t n = left < dlen ? left : dlen;
+
+	// Strings are walked from their end, so skip the part that doesn't fit.
+	for (size_t i=n ; i < left ; ++i) {
+		code = lzw_node_parent(state->tree.node[code]);
+	}
+	for (size_t i=0 ; i < n ; ++i) {
+		dest[n - 1 - i] = lzw_node_symbol(state->tree.node[code]);
+		code = lzw_node_parent(state->tree.node[code]);
+	}
+	state->split_left = left - n;
+
+	return n;
+}
+
+LZW_FORCE_INLINE ssize_t lzw_decompress_variant(struct lzw_state *state, const uint32_t variant, uint8_t *src, size_t slen, uint8_t *dest, size_t dlen) {
+	if ((state->flags & STATE_WAS_INIT) == 0) {
+		enum lzw_errors err = lzw_init_decoder(state, variant, src, slen);
+		if (err != LZW_NOERROR)
+			return err;
+	}
+
+	if (state->flags & STATE_END)
+		return 0;
+
+	// Returning 0 would look like the end of input.
+	if (!(variant & VARIANT_VERIFY) && dlen == 0)
+		return LZW_DESTINATION_TOO_SMALL;
+
+	if ((variant & VARIANT_FLUSH) && (state->flags & STATE_SYNCED)) {
+		state->rptr = 0;
+		state->flags &= ~STATE_SYNCED;
+	}
+
+	const code_t code_clear = lzw_code_clear(state, variant);
+	const code_t code_first = lzw_code_first(state, variant);
+	const uint32_t early_change = (variant & VARIANT_EARLY_CHANGE) ? 1 : 0;
 
 	// Keep local copies so that we can exit and continue without losing bits.
-	uint32_t bitres = state->bitres;
+	bitres_t bitres = state->bitres;
 	uint32_t bitres_len = state->bitres_len;
 
 	uint32_t code = 0;
 	size_t wptr = 0;
 
-	while (state->rptr < slen) {
+	// Finish the string cut short at the end of the last call.
+	if (!(variant & VARIANT_VERIFY) && state->split_left > 0) {
+		wptr = lzw_output_string_tail(state, state->split_code, state->split_left, dest, dlen);
+	}
+
+	// Codes narrower than a byte can be left whole in the reservoir after the input runs out.
+	while (state->rptr < slen || ((variant & VARIANT_ROOT_WIDTH) && bitres_len >= state->tree.code_width)) {
+		if (!(variant & VARIANT_VERIFY) && wptr == dlen)
+			break;
+
+		if ((variant & VARIANT_BLOCK_MODE) && state->pad_bits > 0) {
+			if (bitres_len == 0) {
+				bitres = src[state->rptr++];
+				bitres_len = 8;
+			}
+			uint32_t skip = state->pad_bits < bitres_len ? state->pad_bits : bitres_len;
+			bitres >>= skip;
+			bitres_len -= skip;
+			state->pad_bits -= skip;
+			state->bitres = bitres;
+			state->bitres_len = bitres_len;
+			continue;
+		}
+
 		// Fill bit-reservoir.
 		while ((bitres_len < state->tree.code_width) && (state->rptr < slen)) {
-			bitres |= src[state->rptr++] << bitres_len;
+			if (variant & VARIANT_MSB_FIRST) {
+				bitres = (bitres << 8) | src[state->rptr++];
+			} else {
+				bitres |= (bitres_t)src[state->rptr++] << bitres_len;
+			}
 			bitres_len += 8;
 		}
 
@@ -228,26 +576,41 @@ ssize_t lzw_decompress(struct lzw_state *state, uint8_t *src, size_t slen, uint8
 		state->bitres_len = bitres_len;
 
 		if (state->bitres_len < state->tree.code_width) {
+			// compress(1) has no EOF code, so whatever is left is padding. When verifying, the rest is in the next chunk.
+			if (variant & (VARIANT_BLOCK_MODE | VARIANT_VERIFY))
+				break;
 			return LZW_INVALID_CODE_STREAM;
 		}
 
-		code = bitres & mask_from_width(state->tree.code_width);
-		bitres >>= state->tree.code_width;
+		if (variant & VARIANT_MSB_FIRST) {
+			code = (bitres >> (bitres_len - state->tree.code_width)) & mask_from_width(state->tree.code_width);
+		} else {
+			code = bitres & mask_from_width(state->tree.code_width);
+			bitres >>= state->tree.code_width;
+		}
 		bitres_len -= state->tree.code_width;
 
-		if (code == CODE_CLEAR) {
-			if (state->tree.next_code != CODE_FIRST)
-				lzw_reset(state);
+		if (code == code_clear) {
+			if (variant & VARIANT_BLOCK_MODE) {
+				++state->group_codes;
+				state->pad_bits = lzw_group_padding(state);
+			}
+			if (state->tree.next_code != code_first)
+				lzw_reset(state, variant);
 			continue;
-		} else if (code == CODE_EOF) {
+		} else if (!(variant & VARIANT_BLOCK_MODE) && code == (code_t)(code_clear + 1)) {
+			state->flags |= STATE_END;
 			break;
-		} else if (state->must_reset) {
+		} else if ((state->flags & STATE_MUST_RESET) && !(variant & VARIANT_DEFERRED_CLEAR)) {
 			// ERROR: Ran out of space in string table
 			return LZW_STRING_TABLE_FULL;
 		}
 
+		// With a deferred clear, the last code added is still valid, but no new codes are created.
+		bool table_full = (variant & VARIANT_DEFERRED_CLEAR) && (state->flags & STATE_MUST_RESET);
+
 		if (code <= state->tree.next_code) {
-			bool known_code = code < state->tree.next_code;
+			bool known_code = code < state->tree.next_code || table_full;
 			code_t tcode = known_code ? code : state->tree.prev_code;
 			size_t prefix_len = 1 + lzw_node_prefix_len(state->tree.node[tcode]);
 			uint8_t symbol = 0;
@@ -255,7 +618,7 @@ ssize_t lzw_decompress(struct lzw_state *state, uint8_t *src, size_t slen, uint8
 			assert(prefix_len > 0);
 
 			// Invalid state, invalid input.
-			if (!known_code && state->tree.prev_code == CODE_EOF) {
+			if (!known_code && state->tree.prev_code == code_clear) {
 				return LZW_INVALID_CODE_STREAM;
 			}
 
@@ -264,45 +627,83 @@ ssize_t lzw_decompress(struct lzw_state *state, uint8_t *src, size_t slen, uint8
 				state->longest_prefix = prefix_len;
 			}
 
-			// Check if prefix alone too large for output buffer. User could start over with a larger buffer.
-			if (prefix_len + (known_code ? 0 : 1) > dlen) {
-				return LZW_DESTINATION_TOO_SMALL;
-			}
-
-			// Check if room in output buffer, else return early.
-			if (wptr + prefix_len + (known_code ? 0 : 1) > dlen) {
-				return wptr;
+			// When verifying, running past the end of the original is a mismatch.
+			if ((variant & VARIANT_VERIFY) && wptr + prefix_len + (known_code ? 0 : 1) > dlen) {
+				return LZW_VERIFY_MISMATCH;
 			}
 
-			// Write out prefix to destination
-			for (size_t i=0 ; i < prefix_len ; ++i) {
-				symbol = lzw_node_symbol(state->tree.node[tcode]);
-				dest[wptr + prefix_len - 1 - i] = symbol;
-				tcode = lzw_node_parent(state->tree.node[tcode]);
+			// Only count the code once we know it won't be read again on the next call.
+			if (variant & VARIANT_BLOCK_MODE)
+				++state->group_codes;
+
+			size_t avail = dlen - wptr;
+			bool split = !(variant & VARIANT_VERIFY) && prefix_len + (known_code ? 0 : 1) > avail;
+
+			if (split) {
+				// Only what fits is written now, the rest at the start of the next call. By then the table
+				// holds the string for an unknown code too. The first symbol is still needed for the new code.
+				lzw_output_string_tail(state, tcode, prefix_len, dest + wptr, avail);
+				symbol = dest[wptr];
+				state->split_code = code;
+				state->split_left = prefix_len + (known_code ? 0 : 1) - avail;
+				wptr = dlen;
+			} else {
+#ifdef LZW_PACKED_STRINGS
+				// Short strings go out with a single store. The bytes past the string are overwritten by what follows.
+				if (!(variant & VARIANT_VERIFY) && prefix_len <= PACKED_MAX_LEN && wptr + PACKED_MAX_LEN <= dlen) {
+					uint64_t packed = state->tree.packed[tcode];
+					memcpy(dest + wptr, &packed, sizeof(packed));
+					symbol = (packed >> lzw_packed_shift(0)) & SYMBOL_MASK;
+				} else
+#endif
+				// Write out prefix to destination
+				for (size_t i=0 ; i < prefix_len ; ++i) {
+					symbol = lzw_node_symbol(state->tree.node[tcode]);
+					if (variant & VARIANT_VERIFY) {
+						if (dest[wptr + prefix_len - 1 - i] != symbol)
+							return LZW_VERIFY_MISMATCH;
+					} else {
+						dest[wptr + prefix_len - 1 - i] = symbol;
+					}
+					tcode = lzw_node_parent(state->tree.node[tcode]);
+				}
+				wptr += prefix_len;
 			}
-			wptr += prefix_len;
 
 			// Add the first character of the prefix as a new code with prev_code as the parent.
-			if (state->tree.prev_code != CODE_EOF) {
-				if (!known_code) {
+			if (state->tree.prev_code != code_clear) {
+				if (!known_code && !split) {
 					assert(code == state->tree.next_code);
 					assert(wptr < dlen);
-					dest[wptr++] = symbol; // Special case for new codes.
+					if ((variant & VARIANT_VERIFY) && dest[wptr] != symbol)
+						return LZW_VERIFY_MISMATCH;
+					if (!(variant & VARIANT_VERIFY))
+						dest[wptr] = symbol;
+					wptr++; // Special case for new codes.
 				}
 
-				state->tree.node[state->tree.next_code] = lzw_make_node(symbol, state->tree.prev_code, 1 + lzw_node_prefix_len(state->tree.node[state->tree.prev_code]));
+				if (!table_full) {
+					size_t prev_len = 1 + lzw_node_prefix_len(state->tree.node[state->tree.prev_code]);
+					state->tree.node[state->tree.next_code] = lzw_make_node(symbol, state->tree.prev_code, prev_len);
+#ifdef LZW_PACKED_STRINGS
+					if (prev_len < PACKED_MAX_LEN)
+						state->tree.packed[state->tree.next_code] = state->tree.packed[state->tree.prev_code] | ((uint64_t)symbol << lzw_packed_shift(prev_len));
+#endif
 
-				// TODO: Change to ==
-				if (state->tree.next_code >= mask_from_width(state->tree.code_width)) {
-					if (state->tree.code_width == LZW_MAX_CODE_WIDTH) {
-						// Out of bits in code, next code MUST be a reset!
-						state->must_reset = true;
-						state->tree.prev_code = code;
-						continue;
+					// TODO: Change to ==
+					if (state->tree.next_code >= mask_from_width(state->tree.code_width) - early_change) {
+						if (state->tree.code_width == state->max_code_width) {
+							// Out of bits in code, next code MUST be a reset!
+							state->flags |= STATE_MUST_RESET;
+							state->tree.prev_code = code;
+							continue;
+						}
+						if (variant & VARIANT_BLOCK_MODE)
+							state->pad_bits = lzw_group_padding(state);
+						++state->tree.code_width;
 					}
-					++state->tree.code_width;
+					state->tree.next_code++;
 				}
-				state->tree.next_code++;
 			}
 			state->tree.prev_code = code;
 		} else {
@@ -310,10 +711,205 @@ ssize_t lzw_decompress(struct lzw_state *state, uint8_t *src, size_t slen, uint8
 			return LZW_INVALID_CODE_STREAM;
 		}
 	}
+	if ((variant & VARIANT_FLUSH) && state->rptr == slen) {
+		// What's left of the last byte is padding, and the encoder added no code for the last one in the message.
+		bitres = 0;
+		bitres_len = 0;
+		state->pad_bits = 0;
+		state->tree.prev_code = code_clear;
+		if (wptr == 0)
+			state->flags |= STATE_SYNCED;
+	}
+	// Don't leave already decoded codes in the reservoir.
+	state->bitres = bitres;
+	state->bitres_len = bitres_len;
+
 	return wptr;
 }
 
-static bool lzw_string_table_lookup(struct lzw_state *state, uint8_t *prefix, size_t len, code_t *code) {
+ssize_t lzw_decompress(struct lzw_state *state, uint8_t *src, size_t slen, uint8_t *dest, size_t dlen) {
+	switch (state->variant) {
+		case LZW_VARIANT_PUZZNIC:
+			return lzw_decompress_variant(state, VARIANT_PUZZNIC_FLAGS, src, slen, dest, dlen);
+		case LZW_VARIANT_GIF:
+			return lzw_decompress_variant(state, VARIANT_GIF_FLAGS, src, slen, dest, dlen);
+		case LZW_VARIANT_TIFF:
+			return lzw_decompress_variant(state, VARIANT_TIFF_FLAGS, src, slen, dest, dlen);
+		case LZW_VARIANT_COMPRESS:
+			return lzw_decompress_variant(state, VARIANT_COMPRESS_FLAGS, src, slen, dest, dlen);
+	}
+	return LZW_INVALID_PARAMETER;
+}
+
+ssize_t lzw_decompress_flush(struct lzw_state *state, uint8_t *src, size_t slen, uint8_t *dest, size_t dlen) {
+	if (state->symbol_width != 0 && state->symbol_width < 7)
+		return LZW_INVALID_PARAMETER;
+
+	switch (state->variant) {
+		case LZW_VARIANT_PUZZNIC:
+			return lzw_decompress_variant(state, VARIANT_PUZZNIC_FLAGS | VARIANT_FLUSH, src, slen, dest, dlen);
+		case LZW_VARIANT_GIF:
+			return lzw_decompress_variant(state, VARIANT_GIF_FLAGS | VARIANT_FLUSH, src, slen, dest, dlen);
+		case LZW_VARIANT_TIFF:
+			return lzw_decompress_variant(state, VARIANT_TIFF_FLAGS | VARIANT_FLUSH, src, slen, dest, dlen);
+		case LZW_VARIANT_COMPRESS:
+			return lzw_decompress_variant(state, VARIANT_COMPRESS_FLAGS | VARIANT_FLUSH, src, slen, dest, dlen);
+	}
+	return LZW_INVALID_PARAMETER;
+}
+
+// As with `dlen` zero, returning 0 for no room at all would signal end of input.
+static bool lzw_iov_empty(const struct iovec *iov, int iovcnt) {
+	for (int i=0 ; i < iovcnt ; ++i) {
+		if (iov[i].iov_len > 0)
+			return false;
+	}
+	return true;
+}
+
+ssize_t lzw_decompressv(struct lzw_state *state, uint8_t *src, size_t slen, const struct iovec *iov, int iovcnt) {
+	size_t total = 0;
+
+	if (lzw_iov_empty(iov, iovcnt))
+		return LZW_DESTINATION_TOO_SMALL;
+
+	for (int i=0 ; i < iovcnt ; ++i) {
+		uint8_t *base = (uint8_t *)iov[i].iov_base;
+		size_t off = 0;
+
+		while (off < iov[i].iov_len) {
+			ssize_t res = lzw_decompress(state, src, slen, base + off, iov[i].iov_len - off);
+			if (res < 0)
+				return res;
+			if (res == 0)
+				return total + off;
+			off += res;
+		}
+		total += off;
+	}
+
+	return total;
+}
+
+#ifdef LZW_HASHED_LOOKUP
+static inline uint32_t lzw_hash_mask(const struct lzw_state *state) {
+	return (2UL << state->max_code_width) - 1;
+}
+
+// Fibonacci hashing; the top bits of the product are the best mixed.
+static inline uint32_t lzw_hash_slot(const struct lzw_state *state, code_t parent, sym_t symbol) {
+	uint32_t key = ((uint32_t)parent << SYMBOL_BITS) | symbol;
+	return (uint32_t)(key * 0x9E3779B1UL) >> (31 - state->max_code_width);
+}
+
+// Linear probing. An existing entry for the same parent and symbol is replaced, so the newest code wins.
+static void lzw_hash_insert(struct lzw_state *state, code_t code) {
+	const uint32_t mask = lzw_hash_mask(state);
+	lzw_node node = state->tree.node[code];
+	uint32_t i = lzw_hash_slot(state, lzw_node_parent(node), lzw_node_symbol(node));
+
+	while (state->tree.hash[i] != 0) {
+		lzw_node other = state->tree.node[state->tree.hash[i]];
+		if (lzw_node_parent(other) == lzw_node_parent(node) && lzw_node_symbol(other) == lzw_node_symbol(node))
+			break;
+		i = (i + 1) & mask;
+	}
+	state->tree.hash[i] = code;
+}
+
+// Empty the table before the string table is reset. Every entry sits in the run of occupied slots that starts at its
+// code's home slot, so clearing each such run clears the table in time proportional to the codes used, not its size.
+static void lzw_hash_clear(struct lzw_state *state) {
+	const uint32_t mask = lzw_hash_mask(state);
+
+	for (size_t code=0 ; code < state->tree.next_code ; ++code) {
+		lzw_node node = state->tree.node[code];
+		for (uint32_t i = lzw_hash_slot(state, lzw_node_parent(node), lzw_node_symbol(node)) ; state->tree.hash[i] != 0 ; i = (i + 1) & mask) {
+			state->tree.hash[i] = 0;
+		}
+	}
+}
+#endif
+
+#ifndef LZW_HASHED_LOOKUP
+// Find the newest node in [lo, hi) that equals `key` in the bits set in `mask`. Returns 0 if there is none,
+// which is never a valid result since `lo` is at least the first code.
+static size_t lzw_find_node_scalar(const lzw_node *node, size_t lo, size_t hi, lzw_node mask, lzw_node key) {
+	for (size_t i=hi ; i > lo ; --i) {
+		if ((node[i - 1] & mask) == key)
+			return i - 1;
+	}
+	return 0;
+}
+
+#if defined(LZW_DISPATCH_X86)
+__attribute__((target("sse4.2")))
+static size_t lzw_find_node_sse42(const lzw_node *node, size_t lo, size_t hi, lzw_node mask, lzw_node key) {
+#if LZW_MAX_CODE_WIDTH > 12
+	const size_t lanes = 2;
+	const __m128i vmask = _mm_set1_epi64x((long long)mask);
+	const __m128i vkey = _mm_set1_epi64x((long long)key);
+#else
+	const size_t lanes = 4;
+	const __m128i vmask = _mm_set1_epi32((int)mask);
+	const __m128i vkey = _mm_set1_epi32((int)key);
+#endif
+	for ( ; hi >= lo + lanes ; hi -= lanes) {
+		__m128i v = _mm_and_si128(_mm_loadu_si128((const __m128i *)(node + hi - lanes)), vmask);
+#if LZW_MAX_CODE_WIDTH > 12
+		int bits = _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpeq_epi64(v, vkey)));
+#else
+		int bits = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(v, vkey)));
+#endif
+		if (bits)
+			return hi - lanes + (31 - __builtin_clz(bits));
+	}
+	return lzw_find_node_scalar(node, lo, hi, mask, key);
+}
+
+__attribute__((target("avx2")))
+static size_t lzw_find_node_avx2(const lzw_node *node, size_t lo, size_t hi, lzw_node mask, lzw_node key) {
+#if LZW_MAX_CODE_WIDTH > 12
+	const size_t lanes = 4;
+	const __m256i vmask = _mm256_set1_epi64x((long long)mask);
+	const __m256i vkey = _mm256_set1_epi64x((long long)key);
+#else
+	const size_t lanes = 8;
+	const __m256i vmask = _mm256_set1_epi32((int)mask);
+	const __m256i vkey = _mm256_set1_epi32((int)key);
+#endif
+	for ( ; hi >= lo + lanes ; hi -= lanes) {
+		__m256i v = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(node + hi - lanes)), vmask);
+#if LZW_MAX_CODE_WIDTH > 12
+		int bits = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(v, vkey)));
+#else
+		int bits = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(v, vkey)));
+#endif
+		if (bits)
+			return hi - lanes + (31 - __builtin_clz(bits));
+	}
+	return lzw_find_node_scalar(node, lo, hi, mask, key);
+}
+
+// The kernel is picked once, before main() runs, instead of testing the CPU features on every scan.
+static size_t (*lzw_find_node)(const lzw_node *node, size_t lo, size_t hi, lzw_node mask, lzw_node key) = lzw_find_node_scalar;
+
+__attribute__((constructor))
+static void lzw_select_find_node(void) {
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		lzw_find_node = lzw_find_node_avx2;
+	else if (__builtin_cpu_supports("sse4.2"))
+		lzw_find_node = lzw_find_node_sse42;
+}
+#else
+static inline size_t lzw_find_node(const lzw_node *node, size_t lo, size_t hi, lzw_node mask, lzw_node key) {
+	return lzw_find_node_scalar(node, lo, hi, mask, key);
+}
+#endif
+#endif
+
+static bool lzw_string_table_lookup(struct lzw_state *state, code_t code_first, uint8_t *prefix, size_t len, code_t *code) {
 	// printf("Looking up prefix '%.*s' from %p to %p (len=%zu)\n", (int)(len), prefix, prefix, prefix+len, len);
 	assert (len > 0);
 
@@ -322,139 +918,250 @@ static bool lzw_string_table_lookup(struct lzw_state *state, uint8_t *prefix, si
 		return true;
 	}
 
-	// PERF: This is slow, we should store an array of hashes to use as an initial comparison before walking the tree.
+#ifdef LZW_HASHED_LOOKUP
+	// The encoder extends its match one symbol at a time, so `code` already holds the code for all but the last symbol.
+	const uint32_t mask = lzw_hash_mask(state);
+	sym_t symbol = prefix[len - 1];
+	(void)code_first;
+
+	for (uint32_t i = lzw_hash_slot(state, *code, symbol) ; state->tree.hash[i] != 0 ; i = (i + 1) & mask) {
+		lzw_node node = state->tree.node[state->tree.hash[i]];
+		if (lzw_node_parent(node) == *code && lzw_node_symbol(node) == symbol) {
+			*code = state->tree.hash[i];
+			return true;
+		}
+	}
+#else
 	// NOTE: It's imperative that we search newest to oldest. When limiting the prefix length, we'll
 	// end up with duplicate prefixes, and only the newest code is valid for the decoder to stay in sync.
-	for (size_t i=state->tree.next_code - 1 ; i >= CODE_FIRST ; --i) {
+	// Candidates are found by their length and last symbol, then the rest of the string is compared.
+	const lzw_node mask = lzw_make_node(SYMBOL_MASK, 0, PREFIXLEN_MASK);
+	const lzw_node key = lzw_make_node(prefix[len - 1], 0, (code_t)(len - 1));
+
+	for (size_t i=state->tree.next_code ; (i = lzw_find_node(state->tree.node, code_first, i, mask, key)) != 0 ; ) {
 		assert(i < LZW_MAX_CODES);
 		lzw_node node = state->tree.node[i];
 
-		if (len - 1 == lzw_node_prefix_len(node)) {
-			for (size_t j=0 ; j < len ; ++j) {
-				if (prefix[len-j-1] != lzw_node_symbol(node)) {
-					break;
-				}
-				if (lzw_node_prefix_len(node) == 0) {
-					*code = (code_t)i;
-					assert(j == len - 1);
-					return true;
-				}
-				node = state->tree.node[lzw_node_parent(node)];
+		for (size_t j=0 ; j < len ; ++j) {
+			if (prefix[len-j-1] != lzw_node_symbol(node)) {
+				break;
+			}
+			if (lzw_node_prefix_len(node) == 0) {
+				*code = (code_t)i;
+				assert(j == len - 1);
+				return true;
 			}
+			node = state->tree.node[lzw_node_parent(node)];
 		}
 	}
+#endif
 
 	return false;
 }
 
-inline static void lzw_output_code(struct lzw_state *state, code_t code) {
+LZW_FORCE_INLINE void lzw_output_code(struct lzw_state *state, const uint32_t variant, code_t code) {
 	assert(state->bitres_len + state->tree.code_width <= sizeof(bitres_t)*8); // maybe increase size of bitres_t?
-	state->bitres |= code << state->bitres_len;
+	if (variant & VARIANT_MSB_FIRST) {
+		state->bitres = (state->bitres << state->tree.code_width) | code;
+	} else {
+		state->bitres |= (bitres_t)code << state->bitres_len;
+	}
 	state->bitres_len += state->tree.code_width;
 	state->tree.prev_code = code;
 
+	if (variant & VARIANT_BLOCK_MODE)
+		++state->group_codes;
+
 	// printf("<CODE:%d width=%d reservoir:%02d/%zu:%02x>\n", code, state->tree.code_width, state->bitres_len, sizeof(bitres_t)*8, state->bitres);
 }
 
-static void lzw_flush_reservoir(struct lzw_state *state, uint8_t *dest, bool final) {
+LZW_FORCE_INLINE void lzw_flush_reservoir(struct lzw_state *state, const uint32_t variant, uint8_t *dest, bool final) {
 	// SECURITY: We assume we have enough space left in dest!
 
 	// Write codes to output.
 	while (state->bitres_len >= 8) {
-		dest[state->wptr++] = state->bitres & 0xFF;
-		state->bitres >>= 8;
+		if (variant & VARIANT_MSB_FIRST) {
+			dest[state->wptr++] = (state->bitres >> (state->bitres_len - 8)) & 0xFF;
+		} else {
+			dest[state->wptr++] = state->bitres & 0xFF;
+			state->bitres >>= 8;
+		}
 		state->bitres_len -= 8;
 		// printf("DEBUG: Flushed: %02x, reservoir:%02d/%zu:%02x\n", dest[state->wptr-1], state->bitres_len, sizeof(bitres_t)*8, state->bitres);
 	}
 
 	if (final && state->bitres_len > 0) {
 		// printf("DEBUG: Flushing last %d bits.\n", state->bitres_len);
-		dest[state->wptr++] = state->bitres;
+		if (variant & VARIANT_MSB_FIRST) {
+			dest[state->wptr++] = (state->bitres << (8 - state->bitres_len)) & 0xFF;
+		} else {
+			dest[state->wptr++] = state->bitres;
+		}
 		state->bitres = 0;
 		state->bitres_len = 0;
 		// printf("DEBUG: Flushed: %02x, reservoir:%02d/%zu:%02x\n", dest[state->wptr-1], state->bitres_len, sizeof(bitres_t)*8, state->bitres);
 	}
 }
 
-ssize_t lzw_compress(struct lzw_state *state, uint8_t *src, size_t slen, uint8_t *dest, size_t dlen) {
-	if (state->was_init == false) {
-		lzw_init(state);
-		lzw_output_code(state, CODE_CLEAR);
+// Pad with zero bits up to the end of the current group of codes.
+LZW_FORCE_INLINE void lzw_output_padding(struct lzw_state *state, const uint32_t variant, uint8_t *dest) {
+	uint32_t pad = lzw_group_padding(state);
+
+	while (pad > 0) {
+		uint32_t bits = pad < 8 ? pad : 8;
+		if (variant & VARIANT_MSB_FIRST)
+			state->bitres <<= bits;
+		state->bitres_len += bits;
+		pad -= bits;
+		lzw_flush_reservoir(state, variant, dest, false);
 	}
+}
 
-	code_t code = CODE_EOF;
-	size_t prefix_end = 0;
+// Output a code, then widen the code width or reset the table if the next code won't fit.
+// Returns true if the table was reset.
+LZW_FORCE_INLINE bool lzw_emit_code(struct lzw_state *state, const uint32_t variant, uint8_t *dest, code_t code) {
+	const uint32_t early_change = (variant & VARIANT_EARLY_CHANGE) ? 1 : 0;
+
+	// Output code _before_ we potentially change the bit-width.
+	lzw_output_code(state, variant, code);
+
+	// Handle code width expansion.
+	if (state->tree.next_code == (1UL << state->tree.code_width) - early_change
+#if LZW_MAX_CODE_WIDTH == 16
+		|| (state->tree.next_code == LZW_MAX_CODES - 1) /* special case for wrapping on 16-bit code_t */
+#endif
+	) {
+		if (state->tree.code_width < state->max_code_width) {
+			// printf("DEBUG: Expanding bitwidth to %d\n", state->tree.code_width + 1);
+			if (variant & VARIANT_BLOCK_MODE)
+				lzw_output_padding(state, variant, dest);
+			++state->tree.code_width;
+		} else {
+			// printf("DEBUG: Max code-width reached -- Issuing clear/reset\n");
+			lzw_flush_reservoir(state, variant, dest, false);
+			lzw_output_code(state, variant, lzw_code_clear(state, variant));
+			if (variant & VARIANT_BLOCK_MODE)
+				lzw_output_padding(state, variant, dest);
+#ifdef LZW_HASHED_LOOKUP
+			lzw_hash_clear(state);
+#endif
+			lzw_reset(state, variant);
+			lzw_flush_reservoir(state, variant, dest, false);
+			return true;
+		}
+	}
+	return false;
+}
+
+LZW_FORCE_INLINE ssize_t lzw_compress_variant(struct lzw_state *state, const uint32_t variant, uint8_t *src, size_t slen, uint8_t *dest, size_t dlen) {
 	state->wptr = 0;
 
+	if ((state->flags & STATE_WAS_INIT) == 0) {
+		if ((variant & VARIANT_BLOCK_MODE) && dlen < 3)
+			return LZW_DESTINATION_TOO_SMALL;
+
+		enum lzw_errors err = lzw_init(state, variant);
+		if (err != LZW_NOERROR)
+			return err;
+
+		if (variant & VARIANT_BLOCK_MODE) {
+			dest[state->wptr++] = 0x1F;
+			dest[state->wptr++] = 0x9D;
+			dest[state->wptr++] = 0x80 | state->max_code_width;
+		} else {
+			lzw_output_code(state, variant, lzw_code_clear(state, variant));
+		}
+	}
+
+	if ((variant & VARIANT_FLUSH) && (state->flags & STATE_SYNCED)) {
+		state->rptr = 0;
+		state->flags &= ~STATE_SYNCED;
+	}
+
+	const code_t code_clear = lzw_code_clear(state, variant);
+	const code_t code_first = lzw_code_first(state, variant);
+
+	code_t code = code_clear;
+	size_t prefix_end = 0;
+
 	while (state->rptr + prefix_end < slen) {
 		// Ensure we have enough space for flushing codes.
-		if (state->wptr + (state->tree.code_width >> 3) + 1 + 2 + 2 > dlen) { // Also reserve bits for worst-case 16-bit CLEAR + EOF code
-			return state->wptr;
+		// Also reserve bits for worst-case 16-bit CLEAR + EOF code, and compress(1) group padding.
+		if (state->wptr + (state->tree.code_width >> 3) + 1 + 2 + 2 + ((variant & VARIANT_BLOCK_MODE) ? state->tree.code_width : 0) > dlen) {
+			// Returning 0 would look like all input was consumed.
+			return state->wptr > 0 ? (ssize_t)state->wptr : (ssize_t)LZW_DESTINATION_TOO_SMALL;
 		}
 
 		++prefix_end;
+		if ((variant & VARIANT_ROOT_WIDTH) && src[state->rptr + prefix_end - 1] >= code_clear) {
+			return LZW_INVALID_SYMBOL;
+		}
 		// lookup prefix in string table
 		bool overlong = ((state->longest_prefix_allowed > 0) && (prefix_end >= state->longest_prefix_allowed));
-		bool existing_code = lzw_string_table_lookup(state, src + state->rptr, prefix_end, &code);
+		bool existing_code = lzw_string_table_lookup(state, code_first, src + state->rptr, prefix_end, &code);
 		if (!existing_code || overlong) {
-			assert(code != CODE_CLEAR);
-			assert(code != CODE_EOF);
+			assert(code != code_clear);
+			assert((variant & VARIANT_BLOCK_MODE) || code != code_clear + 1);
 
 			uint8_t symbol = src[state->rptr + prefix_end - 1];
 			code_t parent = code;
 			code_t parent_len = 1 + lzw_node_prefix_len(state->tree.node[parent]);
 
-			// Output code _before_ we potentially change the bit-width.
-			lzw_output_code(state, parent);
+			bool reset = lzw_emit_code(state, variant, dest, parent);
 
-			// Handle code width expansion.
-			if (state->tree.next_code == (1UL << state->tree.code_width)
-#if LZW_MAX_CODE_WIDTH == 16
-				|| (state->tree.next_code == LZW_MAX_CODES - 1) /* special case for wrapping on 16-bit code_t */
-#endif
-			) {
-				if (state->tree.code_width < LZW_MAX_CODE_WIDTH) {
-					// printf("DEBUG: Expanding bitwidth to %d\n", state->tree.code_width + 1);
-					++state->tree.code_width;
-				} else {
-					// printf("DEBUG: Max code-width reached -- Issuing clear/reset\n");
-					lzw_flush_reservoir(state, dest, false);
-					lzw_output_code(state, CODE_CLEAR);
-					lzw_reset(state);
-					lzw_flush_reservoir(state, dest, false);
-					state->tree.next_code = CODE_EOF; // XXX: Required for compatibility with puzznic.
+			// A message ending at a flush point has no next symbol the decoder could add, so neither do we.
+			if (!((variant & VARIANT_FLUSH) && state->rptr + parent_len == slen)) {
+				if (reset) {
+					// The entry for the code before the CLEAR is never seen by the decoder, so park it below the first code.
+					state->tree.next_code = code_first - 1; // XXX: Required for compatibility with puzznic.
 				}
-			}
 
-			assert(state->tree.next_code < LZW_MAX_CODES);
-			// printf("New prefix from src[%zu], adding symbol '%c' (%02x) as code %d /w parent %d\n", state->rptr + prefix_end, symbol, symbol, state->tree.next_code, parent);
-			state->tree.node[state->tree.next_code++] = lzw_make_node(symbol, parent, parent_len);
+				assert(state->tree.next_code < LZW_MAX_CODES);
+				// printf("New prefix from src[%zu], adding symbol '%c' (%02x) as code %d /w parent %d\n", state->rptr + prefix_end, symbol, symbol, state->tree.next_code, parent);
+				state->tree.node[state->tree.next_code] = lzw_make_node(symbol, parent, parent_len);
+#ifdef LZW_HASHED_LOOKUP
+				if (state->tree.next_code >= code_first)
+					lzw_hash_insert(state, state->tree.next_code);
+#endif
+				state->tree.next_code++;
 
-			if (parent_len > state->longest_prefix) {
-				state->longest_prefix = parent_len;
+				if (parent_len > state->longest_prefix) {
+					state->longest_prefix = parent_len;
+				}
 			}
 
 			state->rptr += parent_len;
 			prefix_end = 0;
 
-			lzw_flush_reservoir(state, dest, false);
+			lzw_flush_reservoir(state, variant, dest, false);
 		}
 	}
 	if (prefix_end != 0) {
 		// printf("DEBUG: Last prefix existed, writing existing code %d to stream\n", code);
-		lzw_output_code(state, code);
-		lzw_flush_reservoir(state, dest, false);
+		// The decoder widens as it adds the entry for the code before this one, so we must too.
+		lzw_emit_code(state, variant, dest, code);
+		lzw_flush_reservoir(state, variant, dest, false);
 		state->rptr += prefix_end;
 		prefix_end = 0;
 	}
 
+	if (variant & VARIANT_FLUSH) {
+		if (state->rptr == slen) {
+			// Pad to a byte boundary; the decoder drops the partial byte at the end of each message.
+			lzw_flush_reservoir(state, variant, dest, true);
+			if (state->wptr == 0)
+				state->flags |= STATE_SYNCED;
+		}
+		return state->wptr;
+	}
+
 	// WARN: Problem with this is that we can't chain encodes, add 'final' flag to compression call?
-	// NIGHTMARE: Handle zero-input
-	if ((state->rptr + prefix_end == slen && state->tree.prev_code != CODE_EOF)
-		// This happens to be true if we're called with slen=0, but only the first time as we now flush the bits.
-		|| (state->wptr == 0 && state->bitres_len > 0)) {
-		lzw_output_code(state, CODE_EOF);
-		lzw_flush_reservoir(state, dest, true);
+	// This is also what handles zero-input, by writing out the initial CLEAR code.
+	if (state->rptr == slen && (state->flags & STATE_END) == 0) {
+		if (!(variant & VARIANT_BLOCK_MODE))
+			lzw_output_code(state, variant, code_clear + 1);
+		lzw_flush_reservoir(state, variant, dest, true);
+		state->flags |= STATE_END;
 	}
 
 	// if we didn't write anything, there shouldn't be any bits left in reservoir.
@@ -464,6 +1171,267 @@ ssize_t lzw_compress(struct lzw_state *state, uint8_t *src, size_t slen, uint8_t
 
 	return state->wptr;
 }
+
+ssize_t lzw_compress(struct lzw_state *state, uint8_t *src, size_t slen, uint8_t *dest, size_t dlen) {
+	switch (state->variant) {
+		case LZW_VARIANT_PUZZNIC:
+			return lzw_compress_variant(state, VARIANT_PUZZNIC_FLAGS, src, slen, dest, dlen);
+		case LZW_VARIANT_GIF:
+			return lzw_compress_variant(state, VARIANT_GIF_FLAGS, src, slen, dest, dlen);
+		case LZW_VARIANT_TIFF:
+			return lzw_compress_variant(state, VARIANT_TIFF_FLAGS, src, slen, dest, dlen);
+		case LZW_VARIANT_COMPRESS:
+			return lzw_compress_variant(state, VARIANT_COMPRESS_FLAGS, src, slen, dest, dlen);
+	}
+	return LZW_INVALID_PARAMETER;
+}
+
+ssize_t lzw_compress_flush(struct lzw_state *state, uint8_t *src, size_t slen, uint8_t *dest, size_t dlen) {
+	if (state->symbol_width != 0 && state->symbol_width < 7)
+		return LZW_INVALID_PARAMETER;
+
+	switch (state->variant) {
+		case LZW_VARIANT_PUZZNIC:
+			return lzw_compress_variant(state, VARIANT_PUZZNIC_FLAGS | VARIANT_FLUSH, src, slen, dest, dlen);
+		case LZW_VARIANT_GIF:
+			return lzw_compress_variant(state, VARIANT_GIF_FLAGS | VARIANT_FLUSH, src, slen, dest, dlen);
+		case LZW_VARIANT_TIFF:
+			return lzw_compress_variant(state, VARIANT_TIFF_FLAGS | VARIANT_FLUSH, src, slen, dest, dlen);
+		case LZW_VARIANT_COMPRESS:
+			return lzw_compress_variant(state, VARIANT_COMPRESS_FLAGS | VARIANT_FLUSH, src, slen, dest, dlen);
+	}
+	return LZW_INVALID_PARAMETER;
+}
+
+ssize_t lzw_compressv(struct lzw_state *state, uint8_t *src, size_t slen, const struct iovec *iov, int iovcnt) {
+	size_t total = 0;
+
+	if (lzw_iov_empty(iov, iovcnt))
+		return LZW_DESTINATION_TOO_SMALL;
+
+	for (int i=0 ; i < iovcnt ; ++i) {
+		uint8_t *base = (uint8_t *)iov[i].iov_base;
+		size_t off = 0;
+
+		while (off < iov[i].iov_len) {
+			size_t room = iov[i].iov_len - off;
+			if (state->stage_pos < state->stage_len) {
+				size_t n = state->stage_len - state->stage_pos;
+				n = n < room ? n : room;
+				memcpy(base + off, state->stage + state->stage_pos, n);
+				state->stage_pos += n;
+				off += n;
+				continue;
+			}
+			// The encoder stops short of the end of `dest` to leave room for its worst case, so the tail
+			// of each segment is staged and split. The output is small next to the input, so this is cheap.
+			ssize_t res;
+			if (room >= sizeof(state->stage)) {
+				res = lzw_compress(state, src, slen, base + off, room);
+				if (res > 0)
+					off += res;
+			} else {
+				res = lzw_compress(state, src, slen, state->stage, sizeof(state->stage));
+				state->stage_len = res > 0 ? (uint32_t)res : 0;
+				state->stage_pos = 0;
+			}
+			if (res < 0)
+				return res;
+			if (res == 0)
+				return total + off;
+		}
+		total += off;
+	}
+
+	return total;
+}
+
+// Start over with a fresh string table, as for a new stream.
+static void lzw_frame_reset(struct lzw_state *state) {
+	state->flags = 0;
+	state->split_left = 0;
+}
+
+// Compress all of `src` as a stream of its own. Returns LZW_DESTINATION_TOO_SMALL if it doesn't fit in `dlen`.
+static ssize_t lzw_compress_block(struct lzw_state *state, uint8_t *src, size_t slen, uint8_t *dest, size_t dlen) {
+	size_t wptr = 0;
+	ssize_t res;
+
+#ifdef LZW_HASHED_LOOKUP
+	// Only the encoder uses the hash table.
+	if (state->flags & STATE_WAS_INIT)
+		lzw_hash_clear(state);
+#endif
+	lzw_frame_reset(state);
+	while ((res = lzw_compress(state, src, slen, dest + wptr, dlen - wptr)) > 0) {
+		wptr += res;
+	}
+
+	return res < 0 ? res : (ssize_t)wptr;
+}
+
+// Collision entropy from byte counts. Above about 7.5 bits per byte there's next to nothing for LZW to work with.
+static bool lzw_looks_random(const uint8_t *src, size_t len) {
+	uint32_t count[256] = { 0 };
+	uint64_t sum = 0;
+
+	for (size_t i=0 ; i < len ; ++i) {
+		++count[src[i]];
+	}
+	for (size_t i=0 ; i < 256 ; ++i) {
+		sum += (uint64_t)count[i] * count[i];
+	}
+
+	return sum * 181 < (uint64_t)len * len;
+}
+
+ssize_t lzw_compress_framed(struct lzw_state *state, uint8_t *src, size_t slen, uint8_t *dest, size_t dlen) {
+	size_t blen = slen - state->frame_rptr;
+
+	if (blen == 0)
+		return 0;
+	if (blen > LZW_FRAME_BLOCK_SIZE)
+		blen = LZW_FRAME_BLOCK_SIZE;
+	if (dlen < LZW_FRAME_HEADER_SIZE + blen)
+		return LZW_DESTINATION_TOO_SMALL;
+
+	uint8_t *block = src + state->frame_rptr;
+	uint8_t *payload = dest + LZW_FRAME_HEADER_SIZE;
+	bool compressible = true;
+	ssize_t res;
+
+	// Confirm with a short trial run, since repeats of random data have the same statistics.
+	if (lzw_looks_random(block, blen)) {
+		size_t sample = blen < FRAME_SAMPLE_SIZE ? blen : FRAME_SAMPLE_SIZE;
+		res = lzw_compress_block(state, block, sample, payload, sample);
+		if (res < 0 && res != LZW_DESTINATION_TOO_SMALL)
+			return res;
+		compressible = res >= 0 && (size_t)res < sample;
+	}
+	res = LZW_DESTINATION_TOO_SMALL;
+	if (compressible)
+		res = lzw_compress_block(state, block, blen, payload, blen);
+	if (res < 0 && res != LZW_DESTINATION_TOO_SMALL)
+		return res;
+
+	uint32_t len;
+	if (res >= 0 && (size_t)res < blen) {
+		dest[0] = FRAME_LZW;
+		len = (uint32_t)res;
+	} else {
+		dest[0] = FRAME_STORED;
+		memcpy(payload, block, blen);
+		len = (uint32_t)blen;
+	}
+	for (size_t i=0 ; i < 4 ; ++i) {
+		dest[1 + i] = (len >> (i * 8)) & 0xFF;
+	}
+	state->frame_rptr += blen;
+
+	return LZW_FRAME_HEADER_SIZE + len;
+}
+
+ssize_t lzw_decompress_framed(struct lzw_state *state, uint8_t *src, size_t slen, uint8_t *dest, size_t dlen) {
+	size_t wptr = 0;
+
+	while (wptr < dlen) {
+		if (state->frame_type == 0) {
+			if (state->frame_rptr == slen)
+				break;
+			if (slen - state->frame_rptr < LZW_FRAME_HEADER_SIZE)
+				return LZW_INVALID_CODE_STREAM;
+
+			uint8_t *header = src + state->frame_rptr;
+			size_t len = 0;
+			for (size_t i=0 ; i < 4 ; ++i) {
+				len |= (size_t)header[1 + i] << (i * 8);
+			}
+			if ((header[0] != FRAME_STORED && header[0] != FRAME_LZW) || len > slen - state->frame_rptr - LZW_FRAME_HEADER_SIZE)
+				return LZW_INVALID_CODE_STREAM;
+
+			state->frame_type = header[0];
+			state->frame_left = len;
+			state->frame_rptr += LZW_FRAME_HEADER_SIZE;
+			if (state->frame_type == FRAME_LZW)
+				lzw_frame_reset(state);
+		}
+
+		if (state->frame_type == FRAME_STORED) {
+			size_t n = state->frame_left < dlen - wptr ? state->frame_left : dlen - wptr;
+			memcpy(dest + wptr, src + state->frame_rptr, n);
+			state->frame_rptr += n;
+			state->frame_left -= n;
+			wptr += n;
+		} else {
+			// The decoder keeps its own place in the block, so the block is skipped once it's done.
+			ssize_t res = lzw_decompress(state, src + state->frame_rptr, state->frame_left, dest + wptr, dlen - wptr);
+			if (res < 0)
+				return res;
+			wptr += res;
+			if (res == 0) {
+				state->frame_rptr += state->frame_left;
+				state->frame_left = 0;
+			}
+		}
+		if (state->frame_left == 0)
+			state->frame_type = 0;
+	}
+
+	return wptr;
+}
+
+ssize_t lzw_verify(struct lzw_state *state, uint8_t *src, size_t slen, uint8_t *orig, size_t olen) {
+	if (slen == 0) {
+		// Everything must have been reproduced, and the stream properly terminated.
+		bool terminated = (state->flags & STATE_END) || state->variant == LZW_VARIANT_COMPRESS;
+		return (state->wptr == olen && terminated) ? 0 : LZW_VERIFY_MISMATCH;
+	}
+
+	// Each chunk is consumed in full, so the next one starts from the top.
+	if (state->flags & STATE_WAS_INIT)
+		state->rptr = 0;
+
+	// The .Z header may be split across chunks, so it's collected in `stage` before the decoder starts.
+	if (state->variant == LZW_VARIANT_COMPRESS && !(state->flags & STATE_WAS_INIT) && (state->stage_len > 0 || slen < 3)) {
+		size_t n = 3 - state->stage_len < slen ? 3 - state->stage_len : slen;
+		memcpy(state->stage + state->stage_len, src, n);
+		state->stage_len += n;
+		if (state->stage_len < 3)
+			return 0;
+		state->stage_len = 0;
+		enum lzw_errors err = lzw_init_decoder(state, VARIANT_COMPRESS_FLAGS | VARIANT_VERIFY, state->stage, 3);
+		if (err != LZW_NOERROR)
+			return err == LZW_INVALID_PARAMETER ? err : LZW_VERIFY_MISMATCH;
+		state->rptr = n;
+	}
+
+	uint8_t *dest = orig + state->wptr;
+	size_t dlen = olen - state->wptr;
+	ssize_t res = LZW_INVALID_PARAMETER;
+
+	switch (state->variant) {
+		case LZW_VARIANT_PUZZNIC:
+			res = lzw_decompress_variant(state, VARIANT_PUZZNIC_FLAGS | VARIANT_VERIFY, src, slen, dest, dlen);
+			break;
+		case LZW_VARIANT_GIF:
+			res = lzw_decompress_variant(state, VARIANT_GIF_FLAGS | VARIANT_VERIFY, src, slen, dest, dlen);
+			break;
+		case LZW_VARIANT_TIFF:
+			res = lzw_decompress_variant(state, VARIANT_TIFF_FLAGS | VARIANT_VERIFY, src, slen, dest, dlen);
+			break;
+		case LZW_VARIANT_COMPRESS:
+			res = lzw_decompress_variant(state, VARIANT_COMPRESS_FLAGS | VARIANT_VERIFY, src, slen, dest, dlen);
+			break;
+	}
+
+	if (res > 0)
+		state->wptr += res;
+	// A corrupt stream can't reproduce the original either.
+	if (res < 0 && res != LZW_INVALID_PARAMETER)
+		res = LZW_VERIFY_MISMATCH;
+
+	return res;
+}
 #endif // LZW_EDDY_IMPLEMENTATION
 
 #ifdef __cplusplus
@@ -33,9 +33,10 @@ function testfile {
 
 function testcheck {
 	INFILE=$1
+	OPT=$2
 	HASHD=$(sha256sum $INFILE | cut -f 1 -d ' ')
-	./lzw-eddy -c $INFILE -o $TMPFILEC
-	./lzw-eddy -d $TMPFILEC -o $TMPFILED
+	./lzw-eddy $OPT -c $INFILE -o $TMPFILEC
+	./lzw-eddy $OPT -d $TMPFILEC -o $TMPFILED
 	HASHC=$(sha256sum $TMPFILED | cut -f 1 -d ' ')
 	test "$HASHD" = "$HASHC" || (echo "Test failed. -- Compressed hash mismatch" && exit 1)
 }
@@ -45,6 +46,46 @@ testfile tests/abra.txt.lzw "" 3119a48c6843ee7dcc08312e97b1d8e3b241b082996afe761
 testfile tests/zeros80000.lzw "" f8c784aa6b57396e7c5e094c34d079d8252473e46e2f60593a921dbebf941fcc
 testfile tests/zeros80000.lzw "-m 254" f8c784aa6b57396e7c5e094c34d079d8252473e46e2f60593a921dbebf941fcc 58e6c0321a62f7f112e61dca779edc9be0e34cf0ee356f61df949c7aea839492
 testcheck lzw.h
+testcheck lzw.h "-f gif"
+testcheck lzw.h "-f tiff"
+testcheck lzw.h "-f z"
+testcheck tests/AaAx64.txt "-f gif -s 7"
+# An unknown variant must be an error, not silently fall back to the default.
+! ./lzw-eddy -f Z -c lzw.h -o $TMPFILEC 2>/dev/null || (echo "Test failed. -- Unknown variant accepted" && exit 1)
+# Our .Z output should be readable by gzip.
+./lzw-eddy -f z -c lzw.h -o $TMPFILEC
+test "$(gzip -dc < $TMPFILEC | sha256sum | cut -f 1 -d ' ')" = "$(sha256sum lzw.h | cut -f 1 -d ' ')" || (echo "Test failed. -- gzip can't read .Z output" && exit 1)
+for F in puzznic gif tiff z; do
+	./lzw-eddy -f $F --verify -c lzw.h -o $TMPFILEC | grep -q "Verified" || (echo "Test failed. -- Verification failed for $F" && exit 1)
+done
+# Auto-tuned output must decode within the given buffer budget.
+./lzw-eddy -f z -a 64 -n 8192 -c lzw.h -o $TMPFILEC
+./lzw-eddy -f z -m 63 -d $TMPFILEC -o $TMPFILED
+test "$(sha256sum < $TMPFILED)" = "$(sha256sum < lzw.h)" || (echo "Test failed. -- Auto-tuned output mismatch" && exit 1)
+# The last code lands on a code width change, so EOF must go out at the new width.
+seq 1 132 >$TMPFILED
+testcheck $TMPFILED "-f tiff"
+# Sync-flushed messages decode one at a time, sharing the string table.
+for F in puzznic gif tiff z; do
+	testcheck lzw.h "-f $F -F 100"
+done
+# Framed streams store incompressible blocks, so random data only grows by the block headers.
+{ cat lzw.h ; head -c 100000 /dev/urandom ; } >$TMPFILED
+for F in puzznic gif tiff z; do
+	testcheck $TMPFILED "-f $F --framed"
+done
+head -c 100000 /dev/urandom >$TMPFILED
+./lzw-eddy --framed -c $TMPFILED -o $TMPFILEC
+test "$(wc -c < $TMPFILEC)" -le $((100000 + 2*5)) || (echo "Test failed. -- Framed output of random data grew" && exit 1)
+# Starting a block must cost next to nothing at any code width. 16K tiny LZW blocks take seconds if it scales with the table.
+rep 20 a >$TMPFILED
+./lzw-eddy --framed -c $TMPFILED -o $TMPFILEC
+for i in $(seq 1 14); do
+	cat $TMPFILEC $TMPFILEC >$TMPFILED
+	cp $TMPFILED $TMPFILEC
+done
+timeout 10 ./lzw-eddy --framed -d $TMPFILEC -o $TMPFILED || (echo "Test failed. -- Framed block reset too slow" && exit 1)
+test "$(sha256sum < $TMPFILED)" = "$(rep 16384 aaaaaaaaaaaaaaaaaaaa | sha256sum)" || (echo "Test failed. -- Framed blocks mismatch" && exit 1)
 rep 65536 AaA >$TMPFILED
 testcheck $TMPFILED
 echo "All tests passed."